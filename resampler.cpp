@@ -13,7 +13,112 @@
 #include <cmath>
 #include <cassert>
 #include <cstring>
+#include <algorithm>
 #include "resampler.h"
+#include "resampler_simd.h"
+
+#include <string>
+#include <list>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#if defined( __SSE2__ ) || defined( _M_X64 )
+#include <emmintrin.h>
+#endif
+
+#if defined( _MSC_VER ) && ( defined( _M_IX86 ) || defined( _M_X64 ) )
+#include <intrin.h>
+#endif
+
+// Background contributor list construction and thread safe filter registration need C++11 threads.
+#if !defined( RESAMPLER_NO_THREADS ) && ( ( __cplusplus >= 201103L ) || ( defined( _MSC_VER ) && ( _MSC_VER >= 1700 ) ) )
+#define RESAMPLER_THREADS 1
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#endif
+
+// CPU feature checks for the SIMD targets.
+static bool cpu_has_sse41()
+{
+#if ( defined( __GNUC__ ) || defined( __clang__ ) ) && ( defined( __i386__ ) || defined( __x86_64__ ) )
+    return __builtin_cpu_supports( "sse4.1" ) != 0;
+#elif defined( _MSC_VER ) && ( defined( _M_IX86 ) || defined( _M_X64 ) )
+    int info[ 4 ];
+    __cpuid( info, 1 );
+    return ( info[ 2 ] & ( 1 << 19 ) ) != 0;
+#else
+    return false;
+#endif
+}
+
+static bool cpu_has_avx2()
+{
+#if ( defined( __GNUC__ ) || defined( __clang__ ) ) && ( defined( __i386__ ) || defined( __x86_64__ ) )
+    return __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" );
+#elif defined( _MSC_VER ) && ( _MSC_VER >= 1700 ) && ( defined( _M_IX86 ) || defined( _M_X64 ) )
+    int info[ 4 ];
+    __cpuid( info, 1 );
+    const bool fma = ( info[ 2 ] & ( 1 << 12 ) ) != 0;
+    const bool osxsave = ( info[ 2 ] & ( 1 << 27 ) ) != 0;
+    if( !fma || !osxsave || ( ( _xgetbv( 0 ) & 6 ) != 6 ) )
+        return false;
+    __cpuidex( info, 7, 0 );
+    return ( info[ 1 ] & ( 1 << 5 ) ) != 0;
+#else
+    return false;
+#endif
+}
+
+static bool cpu_has_neon()
+{
+    // The NEON target is only compiled in where NEON is part of the baseline.
+    return true;
+}
+
+static const Resampler_Simd_Kernels* find_simd_target( const char* Pname )
+{
+    if( strcmp( Pname, "avx2" ) == 0 )
+        return cpu_has_avx2() ? resampler_simd_avx2() : NULL;
+    if( strcmp( Pname, "sse4.1" ) == 0 )
+        return cpu_has_sse41() ? resampler_simd_sse41() : NULL;
+    if( strcmp( Pname, "neon" ) == 0 )
+        return cpu_has_neon() ? resampler_simd_neon() : NULL;
+    return NULL;
+}
+
+static const Resampler_Simd_Kernels* detect_simd_target()
+{
+    const char* targets[] = { "avx2", "sse4.1", "neon" };
+    for( unsigned int i = 0; i < sizeof( targets ) / sizeof( targets[ 0 ] ); i++ )
+    {
+        if( const Resampler_Simd_Kernels* Pkernels = find_simd_target( targets[ i ] ) )
+            return Pkernels;
+    }
+    return NULL;
+}
+
+// The SIMD kernels in use, NULL runs the scalar code.
+static const Resampler_Simd_Kernels* g_Psimd = detect_simd_target();
+
+// 64-bit file offsets for the spill file.
+static bool seek_file( FILE* Pfile, unsigned long long ofs )
+{
+#ifdef _WIN32
+    return _fseeki64( Pfile, ( __int64 ) ofs, SEEK_SET ) == 0;
+#else
+    return fseeko( Pfile, ( off_t ) ofs, SEEK_SET ) == 0;
+#endif
+}
 
 #define M_PI 3.14159265358979323846
 
@@ -312,6 +417,16 @@ static double kaiser( double alpha, double half_width, double x )
     return bessel0( alpha * sqrt( 1 - ratio * ratio ) ) / bessel0( alpha );
 }
 
+// Window shape for a stopband attenuation in dB.
+static double kaiser_alpha( double att )
+{
+    if( att > 50.0 )
+        return 0.1102 * ( att - 8.7 );
+    if( att > 20.96 )
+        return exp( log( ( double ) 0.58417 * ( att - 20.96 ) ) * 0.4 ) + 0.07886 * ( att - 20.96 );
+    return 0.0;
+}
+
 #define KAISER_SUPPORT 3
 static Resample_Real kaiser_filter( Resample_Real t )
 {
@@ -322,7 +437,7 @@ static Resample_Real kaiser_filter( Resample_Real t )
     {
         // db atten
         const Resample_Real att = 40.0f;
-        const Resample_Real alpha = ( Resample_Real ) ( exp( log( ( double ) 0.58417 * ( att - 20.96 ) ) * 0.4 ) + 0.07886 * ( att - 20.96 ) );
+        const Resample_Real alpha = ( Resample_Real ) kaiser_alpha( att );
         //const Resample_Real alpha = KAISER_ALPHA;
         return ( Resample_Real ) clean( sinc( t ) * kaiser( alpha, KAISER_SUPPORT, t ) );
     }
@@ -358,6 +473,49 @@ static const struct
 
 static const unsigned int NUM_FILTERS = sizeof ( g_filters ) / sizeof ( g_filters[ 0 ] );
 
+// Registered filters are looked up by linear interpolation in a table of this many steps over [0, support].
+static const unsigned int FILTER_LUT_SIZE = 4096;
+
+struct Registered_Filter
+{
+    std::string name;
+    Resample_Real support;
+    std::vector< Resample_Real > lut;   // FILTER_LUT_SIZE + 1 entries
+    unsigned long long hash;
+};
+
+// A list, so names and tables stay put as filters are added.
+static std::list< Registered_Filter > g_registered_filters;
+
+#ifdef RESAMPLER_THREADS
+static std::mutex g_registered_filters_mutex;
+#define RESAMPLER_LOCK_FILTERS() std::lock_guard< std::mutex > filters_lock( g_registered_filters_mutex )
+#else
+#define RESAMPLER_LOCK_FILTERS()
+#endif
+
+// The filter a Resampler was created with. Built-in filters are called directly, registered ones go through their table.
+struct Resampler::Filter
+{
+    const char* Pname;
+    Resample_Real ( *Pfunc )( Resample_Real );
+    Resample_Real support;
+    const Resample_Real* Plut;
+    unsigned long long hash;
+
+    inline Resample_Real operator()( Resample_Real t ) const
+    {
+        if( !Plut )
+            return ( *Pfunc )( t );
+
+        Resample_Real x = ( Resample_Real ) fabs( t ) * ( FILTER_LUT_SIZE / support );
+        if( !( x < ( Resample_Real ) FILTER_LUT_SIZE ) )
+            return 0.0f;
+        unsigned int i = ( unsigned int ) x;
+        return Plut[ i ] + ( Plut[ i + 1 ] - Plut[ i ] ) * ( x - ( Resample_Real ) i );
+    }
+};
+
 // Ensure that the contributing source sample is
 // within bounds. If not, reflect, clamp, or wrap.
 int Resampler::reflect( const int j, const int src_w, const Boundary_Op boundary_op )
@@ -398,88 +556,123 @@ int Resampler::reflect( const int j, const int src_w, const Boundary_Op boundary
     return n;
 }
 
-struct Contrib_Bounds
+struct Resampler::Contrib_Bounds
 {
     // The center of the range in DISCRETE coordinates (pixel center = 0.0f).
     Resample_Real center;
     int left, right;
 };
 
-// The make_clist() method generates, for all destination samples,
-// the list of all source samples with non-zero weighted contributions.
-std::auto_ptr< Resampler::Contrib_List_Container > Resampler::make_clist
-    (
-    unsigned int src_w, unsigned int dst_w,
-    Boundary_Op boundary_op,
-    Resample_Real ( *Pfilter )( Resample_Real ),
-    Resample_Real filter_support,
-    Resample_Real filter_scale,
-    Resample_Real src_ofs
-    )
+// Drops contributors from the tails of a list, smallest first, as long as the sum of their
+// absolute weights stays within max_error, then renormalizes the remaining weights.
+// Returns the number of contributors dropped.
+static unsigned int prune_contribs( Resampler::Contrib_List& clist, Resample_Real max_error )
 {
-    std::vector< Contrib_Bounds > Pcontrib_bounds( dst_w, Contrib_Bounds() );
+    unsigned int beg = 0, end = clist.n;
+    Resample_Real error = 0.0f;
 
-    std::auto_ptr< Contrib_List_Container > clcont( new Contrib_List_Container );
+    while( end - beg > 1 )
+    {
+        const Resample_Real w_beg = ( Resample_Real ) fabs( clist.p[ beg ].weight );
+        const Resample_Real w_end = ( Resample_Real ) fabs( clist.p[ end - 1 ].weight );
+        const Resample_Real w = ( w_beg <= w_end ) ? w_beg : w_end;
 
-    clcont->clists.resize( dst_w );
-    Contrib_List* Pcontrib = &clcont->clists[ 0 ];
+        if( error + w > max_error )
+            break;
 
-    const Resample_Real oo_filter_scale = 1.0f / filter_scale;
+        error += w;
+        if( w_beg <= w_end )
+            beg++;
+        else
+            end--;
+    }
 
-    const Resample_Real NUDGE = 0.5f;
-    const Resample_Real xscale = dst_w / ( Resample_Real ) src_w;
+    if( ( beg == 0 ) && ( end == clist.n ) )
+        return 0;
 
-    const bool downsampling = ( xscale < 1.0f );
+    const unsigned int num_pruned = clist.n - ( end - beg );
+    clist.n = ( unsigned short ) ( end - beg );
+    memmove( clist.p, clist.p + beg, clist.n * sizeof( Resampler::Contrib ) );
 
-    // stretched half width of filter
-    Resample_Real half_width = ( downsampling ? ( filter_support / xscale ) : filter_support ) * filter_scale;
+    Resample_Real total_weight = 0.0f;
+    for( unsigned int j = 0; j < clist.n; j++ )
+        total_weight += clist.p[ j ].weight;
 
-    // Find the source sample(s) that contribute to each destination sample.
-    int n = 0;
-    for( unsigned int i = 0; i < dst_w; i++ )
+    const Resample_Real norm = 1.0f / total_weight;
+
+    unsigned int max_k = 0;
+    total_weight = 0.0f;
+    for( unsigned int j = 0; j < clist.n; j++ )
     {
-        // Convert from discrete to continuous coordinates, scale, then convert back to discrete.
-        Resample_Real center = ( ( Resample_Real ) i + NUDGE ) / xscale;
-        center -= NUDGE;
-        center += src_ofs;
+        clist.p[ j ].weight *= norm;
+        total_weight += clist.p[ j ].weight;
 
-        int left  = static_cast< int > ( ( Resample_Real ) floor( center - half_width ) );
-        int right = static_cast< int > ( ( Resample_Real ) ceil( center + half_width ) );
+        if( clist.p[ j ].weight > clist.p[ max_k ].weight )
+            max_k = j;
+    }
 
-        Pcontrib_bounds[ i ].center = center;
-        Pcontrib_bounds[ i ].left   = left;
-        Pcontrib_bounds[ i ].right  = right;
+    if( total_weight != 1.0f )
+        clist.p[ max_k ].weight += 1.0f - total_weight;
 
-        n += ( right - left + 1 );
-    }
+    return num_pruned;
+}
 
-    // Allocate memory for contributors.
-    int total = n;
-    clcont->cpool.resize( total );
-    Contrib* Pcpool = &clcont->cpool[ 0 ];
-    if( total == 0 )
+// true if every destination sample in [beg, end) has a single contributor, the source sample
+// at the same position, with a weight of 1.0. Pclist points at the list of sample beg.
+// That's the case for an axis which isn't scaled or offset, when the filter is interpolating
+// (zero at all the integers but 0, like box, tent, lanczos or catmullrom).
+bool Resampler::is_identity( const Contrib_List* Pclist, unsigned int beg, unsigned int end )
+{
+    for( unsigned int i = beg; i < end; i++, Pclist++ )
     {
-        return std::auto_ptr< Resampler::Contrib_List_Container >();
+        if( ( Pclist->n != 1 ) || ( Pclist->p[ 0 ].pixel != i ) || ( Pclist->p[ 0 ].weight != 1.0f ) )
+            return false;
     }
+    return true;
+}
 
-    Contrib* Pcpool_next = Pcpool;
+// A range of contributor lists for make_clist_range() to build.
+struct Resampler::Clist_Range
+{
+    Contrib_List* Pclists;
+    const Contrib_Bounds* Pbounds;
+    unsigned int n;
+    Contrib* Pcpool;
+
+    const Filter* Pfilter;
+    Resample_Real oo_filter_scale;
+    Resample_Real t_scale;
+    int src_w;
+    Boundary_Op boundary_op;
+    bool unbounded;
+    int pixel_ofs;
+    Resample_Real max_error;
+
+    // Results.
+    bool ok;
+    unsigned int num_pruned;
+};
 
-    // Create the list of source samples which contribute to each destination sample.
-    for( unsigned int i = 0; i < dst_w; i++ )
+// Creates the list of source samples which contribute to each destination sample of the range.
+void Resampler::make_clist_range( Clist_Range& range )
+{
+    Contrib_List* Pcontrib = range.Pclists;
+    Contrib* Pcpool_next = range.Pcpool;
+
+    for( unsigned int i = 0; i < range.n; i++ )
     {
-        Resample_Real center = Pcontrib_bounds[ i ].center;
-        int left   = Pcontrib_bounds[ i ].left;
-        int right  = Pcontrib_bounds[ i ].right;
+        Resample_Real center = range.Pbounds[ i ].center;
+        int left   = range.Pbounds[ i ].left;
+        int right  = range.Pbounds[ i ].right;
 
         Pcontrib[ i ].n = 0;
         Pcontrib[ i ].p = Pcpool_next;
         Pcpool_next += ( right - left + 1 );
-        assert( ( Pcpool_next - Pcpool ) <= total );
 
         Resample_Real total_weight = 0;
         for( int j = left; j <= right; j++ )
         {
-            total_weight += ( *Pfilter )( ( center - ( Resample_Real ) j ) * oo_filter_scale * ( downsampling ? xscale : 1.0f ) );
+            total_weight += ( *range.Pfilter )( ( center - ( Resample_Real ) j ) * range.oo_filter_scale * range.t_scale );
         }
 
         const Resample_Real norm = static_cast<Resample_Real> ( 1.0f / total_weight );
@@ -490,11 +683,11 @@ std::auto_ptr< Resampler::Contrib_List_Container > Resampler::make_clist
         Resample_Real max_w = -1e+20f;
         for( int j = left; j <= right; j++ )
         {
-            Resample_Real weight = ( *Pfilter )( ( center - ( Resample_Real ) j ) * oo_filter_scale * ( downsampling ? xscale : 1.0f ) ) * norm;
+            Resample_Real weight = ( *range.Pfilter )( ( center - ( Resample_Real ) j ) * range.oo_filter_scale * range.t_scale ) * norm;
             if( weight == 0.0f )
                 continue;
 
-            int n = reflect( j, src_w, boundary_op );
+            int n = range.unbounded ? ( j - range.pixel_ofs ) : reflect( j, range.src_w, range.boundary_op );
 
             // Increment the number of source
             // samples which contribute to the
@@ -502,7 +695,7 @@ std::auto_ptr< Resampler::Contrib_List_Container > Resampler::make_clist
 
             int k = Pcontrib[ i ].n++;
 
-            Pcontrib[ i ].p[ k ].pixel  = ( unsigned short ) ( n ); // store src sample number
+            Pcontrib[ i ].p[ k ].pixel  = ( unsigned int ) ( n ); // store src sample number
             Pcontrib[ i ].p[ k ].weight = weight;               // store src sample weight
 
             // total weight of all contributors
@@ -519,330 +712,2975 @@ std::auto_ptr< Resampler::Contrib_List_Container > Resampler::make_clist
         //assert(max_k != -1);
 
         if( ( max_k == -1 ) || ( Pcontrib[ i ].n == 0 ) )
-        {
-            return std::auto_ptr< Resampler::Contrib_List_Container >();
-        }
+            return;
 
         if( total_weight != 1.0f )
             Pcontrib[ i ].p[ max_k ].weight += 1.0f - total_weight;
+
+        if( range.max_error > 0.0f )
+            range.num_pruned += prune_contribs( Pcontrib[ i ], range.max_error );
     }
 
-    return clcont;
+    range.ok = true;
 }
 
-void Resampler::resample_x( Sample* Pdst, const Sample* Psrc )
+// The make_clist() method generates, for destination samples [dst_beg, dst_end),
+// the list of all source samples with non-zero weighted contributions.
+// Only the lists of the destination subrect are built, the first one is for sample dst_beg.
+// If unbounded is true, there are no image boundaries: boundary_op is ignored, and source
+// sample j is stored as pixel j - pixel_ofs, where pixel_ofs (<= 0) is the leftmost sample used.
+std::auto_ptr< Resampler::Contrib_List_Container > Resampler::make_clist
+    (
+    unsigned int src_w, unsigned int dst_w,
+    unsigned int dst_beg, unsigned int dst_end,
+    Boundary_Op boundary_op,
+    const Filter& filter,
+    Resample_Real filter_scale,
+    Resample_Real src_ofs,
+    Resample_Real max_error,
+    bool unbounded,
+    unsigned int num_threads
+    )
 {
-    assert( Pdst );
-    assert( Psrc );
+    const unsigned int num = dst_end - dst_beg;
+    std::vector< Contrib_Bounds > Pcontrib_bounds( num, Contrib_Bounds() );
 
-    Contrib_List *Pclist = m_Pclist_x + m_dst_subrect_beg_x;
+    std::auto_ptr< Contrib_List_Container > clcont( new Contrib_List_Container );
 
-    for( unsigned i = m_dst_subrect_beg_x; i < m_dst_subrect_end_x; i++, Pclist++ )
-    {
-        Sample total = 0;
-        Contrib *p = Pclist->p;
-        for( unsigned int j = 0; j < Pclist->n; ++j, ++p )
-        {
-            total += Psrc[ p->pixel ] * p->weight;
-        }
+    clcont->clists.resize( num );
+    clcont->num_pruned = 0;
+    clcont->pixel_ofs = 0;
+    Contrib_List* Pcontrib = &clcont->clists[ 0 ];
 
-        *Pdst++ = total;
-    }
-}
+    const Resample_Real oo_filter_scale = 1.0f / filter_scale;
 
-void Resampler::scale_y_mov( Sample* Ptmp, const Sample* Psrc, Resample_Real weight, unsigned int dst_w )
-{
-    // Not += because temp buf wasn't cleared.
-    for( unsigned int i = 0; i < dst_w; i++ )
-        *Ptmp++ = *Psrc++ *weight;
-}
+    const Resample_Real NUDGE = 0.5f;
+    const Resample_Real xscale = dst_w / ( Resample_Real ) src_w;
 
-void Resampler::scale_y_add( Sample* Ptmp, const Sample* Psrc, Resample_Real weight, unsigned int dst_w )
-{
-    for( unsigned int i = 0; i < dst_w; i++ )
-        ( *Ptmp++ ) += *Psrc++ *weight;
-}
+    const bool downsampling = ( xscale < 1.0f );
 
-void Resampler::clamp( Sample* Pdst, unsigned int n, Resample_Real lo, Resample_Real hi )
-{
-    for( unsigned int i = 0; i < n; ++i )
-    {
-        *Pdst = clamp_sample( *Pdst, lo, hi );
-        ++Pdst;
-    }
-}
+    // stretched half width of filter
+    Resample_Real half_width = ( downsampling ? ( filter.support / xscale ) : filter.support ) * filter_scale;
 
-void Resampler::resample_y( Sample* Pdst )
-{
-    Contrib_List* Pclist = &m_Pclist_y[ m_cur_dst_y ];
+    // Find the source sample(s) that contribute to each destination sample.
+    int n = 0;
+    for( unsigned int i = 0; i < num; i++ )
+    {
+        // Convert from discrete to continuous coordinates, scale, then convert back to discrete.
+        Resample_Real center = ( ( Resample_Real ) ( dst_beg + i ) + NUDGE ) / xscale;
+        center -= NUDGE;
+        center += src_ofs;
 
-    Sample* Ptmp = m_delay_x_resample ? &m_Ptmp_buf[ 0 ] : Pdst;
-    assert( Ptmp );
+        int left  = static_cast< int > ( ( Resample_Real ) floor( center - half_width ) );
+        int right = static_cast< int > ( ( Resample_Real ) ceil( center + half_width ) );
 
-    // Process each contributor.
-    for( int i = 0; i < Pclist->n; i++ )
-    {
-        // locate the contributor's location in the scan
-        // buffer -- the contributor must always be found!
+        Pcontrib_bounds[ i ].center = center;
+        Pcontrib_bounds[ i ].left   = left;
+        Pcontrib_bounds[ i ].right  = right;
 
-        std::vector< Sample >& scan_buf = m_Pscan_buf[ Pclist->p[ i ].pixel ];
-        assert( !scan_buf.empty() );
-        Sample* Psrc = &scan_buf[ 0 ];
+        if( unbounded && ( left < clcont->pixel_ofs ) )
+            clcont->pixel_ofs = left;
 
-        if( !i )
-            scale_y_mov( Ptmp, Psrc, Pclist->p[ i ].weight, m_intermediate_x );
-        else
-            scale_y_add( Ptmp, Psrc, Pclist->p[ i ].weight, m_intermediate_x );
+        n += ( right - left + 1 );
+    }
 
-        // If this source line doesn't contribute to any
-        // more destination lines then mark the scanline buffer slot
-        // which holds this source line as free.
-        // (The max. number of slots used depends on the Y
-        //  axis sampling factor and the scaled filter width.)
-        if( --m_Psrc_y_count[ Pclist->p[ i ].pixel ] == 0 )
-        {
-            m_Psrc_y_flag[ Pclist->p[ i ].pixel ] = false;
-            m_Pscan_buf.erase( Pclist->p[ i ].pixel );
-        }
+    // Allocate memory for contributors.
+    int total = n;
+    clcont->cpool.resize( total );
+    Contrib* Pcpool = &clcont->cpool[ 0 ];
+    if( total == 0 )
+    {
+        return std::auto_ptr< Resampler::Contrib_List_Container >();
     }
 
-    // Now generate the destination line
+    // Weigh the contributors, splitting large tables over several threads.
+    unsigned int parts = 1;
+#ifdef RESAMPLER_THREADS
+    if( num_threads > 1 )
+    {
+        parts = num / MIN_THREAD_CLISTS;
+        if( parts > num_threads )
+            parts = num_threads;
+        if( parts < 1 )
+            parts = 1;
+    }
+#else
+    ( void ) num_threads;
+#endif
 
-    // Was X resampling delayed until after Y resampling?
-    if( m_delay_x_resample )
+    std::vector< Clist_Range > ranges( parts );
+    Contrib* Pcpool_next = Pcpool;
+    unsigned int i = 0;
+    for( unsigned int k = 0; k < parts; k++ )
     {
-        assert( Pdst != Ptmp );
-        resample_x( Pdst, Ptmp );
+        Clist_Range& range = ranges[ k ];
+        range.Pclists = Pcontrib + i;
+        range.Pbounds = &Pcontrib_bounds[ i ];
+        range.Pcpool = Pcpool_next;
+        range.Pfilter = &filter;
+        range.oo_filter_scale = oo_filter_scale;
+        range.t_scale = downsampling ? xscale : 1.0f;
+        range.src_w = src_w;
+        range.boundary_op = boundary_op;
+        range.unbounded = unbounded;
+        range.pixel_ofs = clcont->pixel_ofs;
+        range.max_error = max_error;
+        range.ok = false;
+        range.num_pruned = 0;
+
+        const unsigned int end = ( unsigned int ) ( ( ( unsigned long long ) num * ( k + 1 ) ) / parts );
+        range.n = end - i;
+        for( ; i < end; i++ )
+            Pcpool_next += ( Pcontrib_bounds[ i ].right - Pcontrib_bounds[ i ].left + 1 );
     }
-    else
+    assert( ( Pcpool_next - Pcpool ) == total );
+
+#ifdef RESAMPLER_THREADS
+    std::vector< std::thread > threads;
+    for( unsigned int k = 1; k < parts; k++ )
+        threads.push_back( std::thread( make_clist_range, std::ref( ranges[ k ] ) ) );
+#endif
+
+    make_clist_range( ranges[ 0 ] );
+
+#ifdef RESAMPLER_THREADS
+    for( unsigned int k = 0; k < threads.size(); k++ )
+        threads[ k ].join();
+#endif
+
+    for( unsigned int k = 0; k < parts; k++ )
     {
-        assert( Pdst == Ptmp );
+        if( !ranges[ k ].ok )
+            return std::auto_ptr< Resampler::Contrib_List_Container >();
+        clcont->num_pruned += ranges[ k ].num_pruned;
     }
 
-    if( m_lo < m_hi )
-        clamp( Pdst, ( m_dst_subrect_end_x - m_dst_subrect_beg_x ), m_lo, m_hi );
+    return clcont;
 }
 
-bool Resampler::put_line( const Sample* Psrc )
+// Contributor list cache files hold a Clist_File_Header, the number of contributors of each list
+// (unsigned ints), then the contributors of all the lists. The file name is derived from a hash of
+// the key, which the header repeats. Bump CLIST_FILE_VERSION when the format or make_clist() changes.
+static const unsigned int CLIST_FILE_MAGIC = 0x4C435352; // "RSCL"
+static const unsigned int CLIST_FILE_VERSION = 3;
+
+static std::string g_clist_cache_dir;
+static bool g_clist_cache_verify = false;
+
+// Numbers the temporary files of save_clist(), the X and Y lists of a square image can be saved
+// under the same key by two threads at once.
+#ifdef RESAMPLER_THREADS
+static std::atomic< unsigned int > g_clist_tmp_counter( 0 );
+#else
+static unsigned int g_clist_tmp_counter = 0;
+#endif
+
+// Everything make_clist() depends on.
+struct Resampler::Clist_Key
 {
-    if( m_cur_src_y >= m_resample_src_h )
-        return false;
+    char filter_name[ 64 ];
+    unsigned int src_w, dst_w;
+    unsigned int dst_beg, dst_end;
+    int boundary_op;
+    Resample_Real filter_support;
+    Resample_Real filter_scale;
+    Resample_Real src_ofs;
+    Resample_Real max_error;
+    unsigned int unbounded;
+    unsigned int sample_size;
+    unsigned long long filter_hash;     // 0 for built-in filters, otherwise a hash of the table
+};
 
-    // Does this source line contribute to any destination line?  if not, exit now.
-    if( !m_Psrc_y_count[ m_cur_src_y ] )
+struct Clist_File_Header
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int key_size;
+    unsigned int num_clists;
+    unsigned int num_contribs;
+    unsigned int num_pruned;
+    int pixel_ofs;
+    unsigned int reserved;
+    unsigned long long checksum;
+};
+
+// 64-bit FNV-1a over 32-bit words.
+static unsigned long long clist_checksum( const void* Pdata, size_t size, unsigned long long hash = 14695981039346656037ULL )
+{
+    const unsigned char* Pbytes = static_cast< const unsigned char* >( Pdata );
+    for( size_t i = 0; i + 4 <= size; i += 4 )
     {
-        m_cur_src_y++;
-        return true;
+        unsigned int word;
+        memcpy( &word, Pbytes + i, 4 );
+        hash ^= word;
+        hash *= 1099511628211ULL;
     }
+    return hash;
+}
 
-    // Find an empty slot in the scanline buffer.
-    m_Psrc_y_flag[ m_cur_src_y ] = true;
-    std::vector< Sample >& scan_buf = m_Pscan_buf[ m_cur_src_y ];
-    scan_buf.resize( m_intermediate_x );
+void Resampler::set_clist_cache_dir( const char* Pdir, bool verify )
+{
+    g_clist_cache_dir = Pdir ? Pdir : "";
+    g_clist_cache_verify = verify;
+}
 
-    // Resampling on the X axis first?
-    if( m_delay_x_resample )
+Resampler::Contrib_List_Container::~Contrib_List_Container()
+{
+    if( Pmapping )
     {
-        assert( m_intermediate_x == m_resample_src_w );
+#ifdef _WIN32
+        UnmapViewOfFile( Pmapping );
+#else
+        munmap( Pmapping, mapping_size );
+#endif
+    }
+}
 
-        // Y-X resampling order
-        std::copy( Psrc, Psrc + m_intermediate_x, scan_buf.begin() );
+// Memory maps a cache file, and points the lists into it. NULL if there's no valid file for the key.
+std::auto_ptr< Resampler::Contrib_List_Container > Resampler::load_clist( const char* Ppath, const Clist_Key& key )
+{
+    std::auto_ptr< Contrib_List_Container > clcont;
+
+    void* Pmapping = NULL;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE hfile = CreateFileA( Ppath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+    if( hfile == INVALID_HANDLE_VALUE )
+        return clcont;
+    LARGE_INTEGER file_size;
+    if( GetFileSizeEx( hfile, &file_size ) && ( file_size.QuadPart > 0 ) && ( ( unsigned long long ) file_size.QuadPart <= ( size_t ) -1 ) )
+    {
+        size = ( size_t ) file_size.QuadPart;
+        HANDLE hmapping = CreateFileMappingA( hfile, NULL, PAGE_READONLY, 0, 0, NULL );
+        if( hmapping )
+        {
+            Pmapping = MapViewOfFile( hmapping, FILE_MAP_READ, 0, 0, 0 );
+            CloseHandle( hmapping );
+        }
     }
-    else
+    CloseHandle( hfile );
+#else
+    int fd = open( Ppath, O_RDONLY );
+    if( fd < 0 )
+        return clcont;
+    struct stat st;
+    if( ( fstat( fd, &st ) == 0 ) && ( st.st_size > 0 ) )
     {
-        assert( m_intermediate_x == ( m_dst_subrect_end_x - m_dst_subrect_beg_x ) );
-
-        // X-Y resampling order
-        resample_x( &scan_buf[ 0 ], Psrc );
+        size = ( size_t ) st.st_size;
+        Pmapping = mmap( NULL, size, PROT_READ, MAP_SHARED, fd, 0 );
+        if( Pmapping == MAP_FAILED )
+            Pmapping = NULL;
+    }
+    close( fd );
+#endif
+    if( !Pmapping )
+        return clcont;
+
+    clcont.reset( new Contrib_List_Container );
+    clcont->Pmapping = Pmapping;
+    clcont->mapping_size = size;
+
+    // Validate the header, the key and the sizes before trusting any of it. The checksum reads every
+    // page of the mapping, so it's only checked when asked for.
+    const unsigned char* Pbytes = static_cast< const unsigned char* >( Pmapping );
+    const size_t header_size = sizeof( Clist_File_Header ) + sizeof( Clist_Key );
+    if( size < header_size )
+        return std::auto_ptr< Contrib_List_Container >();
+
+    const Clist_File_Header& header = *reinterpret_cast< const Clist_File_Header* >( Pbytes );
+    if( ( header.magic != CLIST_FILE_MAGIC ) || ( header.version != CLIST_FILE_VERSION ) ||
+        ( header.key_size != sizeof( Clist_Key ) ) || memcmp( Pbytes + sizeof( Clist_File_Header ), &key, sizeof( Clist_Key ) ) ||
+        ( header.num_clists != key.dst_end - key.dst_beg ) || !header.num_clists ||
+        ( size != header_size + ( unsigned long long ) header.num_clists * sizeof( unsigned int ) + ( unsigned long long ) header.num_contribs * sizeof( Contrib ) ) ||
+        ( g_clist_cache_verify && ( header.checksum != clist_checksum( Pbytes + header_size, size - header_size ) ) ) )
+        return std::auto_ptr< Contrib_List_Container >();
+
+    const unsigned int* Pcounts = reinterpret_cast< const unsigned int* >( Pbytes + header_size );
+    Contrib* Pcontribs = reinterpret_cast< Contrib* >( const_cast< unsigned char* >( Pbytes ) + header_size + header.num_clists * sizeof( unsigned int ) );
+
+    // Pointer fixup.
+    clcont->clists.resize( header.num_clists );
+    unsigned long long total = 0;
+    for( unsigned int i = 0; i < header.num_clists; i++ )
+    {
+        if( !Pcounts[ i ] || ( Pcounts[ i ] > 0xFFFF ) || ( total + Pcounts[ i ] > header.num_contribs ) )
+            return std::auto_ptr< Contrib_List_Container >();
+        clcont->clists[ i ].n = ( unsigned short ) Pcounts[ i ];
+        clcont->clists[ i ].p = Pcontribs + total;
+        total += Pcounts[ i ];
     }
 
-    m_cur_src_y++;
-
-    return true;
+    clcont->num_pruned = header.num_pruned;
+    clcont->pixel_ofs = header.pixel_ofs;
+    return clcont;
 }
 
-const Resampler::Sample* Resampler::get_line()
+// Writes the lists to a cache file. The file is written under a temporary name, then renamed, so
+// other processes never map a partial file. Failures are ignored, the cache is only an optimization.
+void Resampler::save_clist( const char* Ppath, const Clist_Key& key, const Contrib_List_Container& clcont )
 {
-    // If all the destination lines have been generated, then always return NULL.
-    if (m_cur_dst_y == m_dst_subrect_end_y)
-        return NULL;
+    const unsigned int num_clists = ( unsigned int ) clcont.clists.size();
 
-    // Check to see if all the required contributors are present, if not, return NULL.
-    for( unsigned int i = 0; i < m_Pclist_y[ m_cur_dst_y ].n; i++ )
-        if( !m_Psrc_y_flag[ m_Pclist_y[ m_cur_dst_y ].p[ i ].pixel ] )
-            return NULL;
-
-    resample_y( &m_Pdst_buf[ 0 ] );
-
-    m_cur_dst_y++;
+    std::vector< unsigned int > counts( num_clists );
+    std::vector< Contrib > contribs;
+    for( unsigned int i = 0; i < num_clists; i++ )
+    {
+        counts[ i ] = clcont.clists[ i ].n;
+        contribs.insert( contribs.end(), clcont.clists[ i ].p, clcont.clists[ i ].p + clcont.clists[ i ].n );
+    }
 
-    return &m_Pdst_buf[ 0 ];
+    Clist_File_Header header;
+    memset( &header, 0, sizeof( header ) );
+    header.magic = CLIST_FILE_MAGIC;
+    header.version = CLIST_FILE_VERSION;
+    header.key_size = sizeof( Clist_Key );
+    header.num_clists = num_clists;
+    header.num_contribs = ( unsigned int ) contribs.size();
+    header.num_pruned = clcont.num_pruned;
+    header.pixel_ofs = clcont.pixel_ofs;
+    header.checksum = clist_checksum( &counts[ 0 ], counts.size() * sizeof( unsigned int ) );
+    header.checksum = clist_checksum( &contribs[ 0 ], contribs.size() * sizeof( Contrib ), header.checksum );
+
+    // Unique to the process and the call.
+    const unsigned int tmp_num = g_clist_tmp_counter++;
+    char tmp_suffix[ 48 ];
+#ifdef _WIN32
+    sprintf_s( tmp_suffix, sizeof( tmp_suffix ), ".%d.%u.tmp", _getpid(), tmp_num );
+#else
+    snprintf( tmp_suffix, sizeof( tmp_suffix ), ".%d.%u.tmp", ( int ) getpid(), tmp_num );
+#endif
+    const std::string tmp_path = std::string( Ppath ) + tmp_suffix;
+
+    FILE* Pfile = fopen( tmp_path.c_str(), "wb" );
+    if( !Pfile )
+        return;
+
+    bool ok = ( fwrite( &header, sizeof( header ), 1, Pfile ) == 1 ) &&
+              ( fwrite( &key, sizeof( key ), 1, Pfile ) == 1 ) &&
+              ( fwrite( &counts[ 0 ], sizeof( unsigned int ), counts.size(), Pfile ) == counts.size() ) &&
+              ( fwrite( &contribs[ 0 ], sizeof( Contrib ), contribs.size(), Pfile ) == contribs.size() );
+    ok = ( fclose( Pfile ) == 0 ) && ok;
+
+    if( !ok || ( rename( tmp_path.c_str(), Ppath ) != 0 ) )
+        remove( tmp_path.c_str() );
 }
 
-Resampler::Resampler
+// The lists of destination samples [dst_beg, dst_end) of one axis, with status set to why there are none.
+std::auto_ptr< Resampler::Contrib_List_Container > Resampler::make_axis_clist
     (
-    unsigned int src_w, unsigned int src_h,
-    unsigned int dst_w, unsigned int dst_h,
+    unsigned int src_w, unsigned int dst_w,
+    unsigned int dst_beg, unsigned int dst_end,
     Boundary_Op boundary_op,
-    Resample_Real sample_low,
-    Resample_Real sample_high,
     const char* Pfilter_name,
-    Contrib_List* Pclist_x,
-    Contrib_List* Pclist_y,
-    Resample_Real filter_x_scale,
-    Resample_Real filter_y_scale,
-    Resample_Real src_x_ofs,
-    Resample_Real src_y_ofs,
-    unsigned int dst_subrect_x, unsigned int dst_subrect_y,
-    unsigned int dst_subrect_w, unsigned int dst_subrect_h
+    Resample_Real filter_scale,
+    Resample_Real src_ofs,
+    Status& status
+    )
+{
+    Filter filter;
+    if( !find_filter( Pfilter_name ? Pfilter_name : RESAMPLER_DEFAULT_FILTER, filter ) )
+    {
+        status = STATUS_BAD_FILTER_NAME;
+        return std::auto_ptr< Contrib_List_Container >();
+    }
+
+    std::auto_ptr< Contrib_List_Container > clcont( make_cached_clist( src_w, dst_w, dst_beg, dst_end, boundary_op, filter, filter_scale, src_ofs, 0.0f, false, 0 ) );
+    status = clcont.get() ? STATUS_OKAY : STATUS_OUT_OF_MEMORY;
+    return clcont;
+}
+
+// make_clist(), going through the cache directory if there's one.
+std::auto_ptr< Resampler::Contrib_List_Container > Resampler::make_cached_clist
+    (
+    unsigned int src_w, unsigned int dst_w,
+    unsigned int dst_beg, unsigned int dst_end,
+    Boundary_Op boundary_op,
+    const Filter& filter,
+    Resample_Real filter_scale,
+    Resample_Real src_ofs,
+    Resample_Real max_error,
+    bool unbounded,
+    unsigned int num_threads
+    )
+{
+    if( g_clist_cache_dir.empty() || ( strlen( filter.Pname ) >= sizeof( ( ( Clist_Key* ) 0 )->filter_name ) ) )
+        return make_clist( src_w, dst_w, dst_beg, dst_end, boundary_op, filter, filter_scale, src_ofs, max_error, unbounded, num_threads );
+
+    // The key is hashed and compared as raw bytes, so clear the padding.
+    Clist_Key key;
+    memset( &key, 0, sizeof( key ) );
+    strcpy( key.filter_name, filter.Pname );
+    key.src_w = src_w;
+    key.dst_w = dst_w;
+    key.dst_beg = dst_beg;
+    key.dst_end = dst_end;
+    key.boundary_op = unbounded ? -1 : boundary_op;
+    key.filter_support = filter.support;
+    key.filter_scale = filter_scale;
+    key.src_ofs = src_ofs;
+    key.max_error = max_error;
+    key.unbounded = unbounded;
+    key.sample_size = sizeof( Resample_Real );
+    key.filter_hash = filter.hash;
+
+    char name[ 64 ];
+    sprintf( name, "/resampler_clist_%016llx.bin", clist_checksum( &key, sizeof( key ) ) );
+    const std::string path = g_clist_cache_dir + name;
+
+    std::auto_ptr< Contrib_List_Container > clcont = load_clist( path.c_str(), key );
+    if( clcont.get() )
+        return clcont;
+
+    clcont = make_clist( src_w, dst_w, dst_beg, dst_end, boundary_op, filter, filter_scale, src_ofs, max_error, unbounded, num_threads );
+    if( clcont.get() )
+        save_clist( path.c_str(), key, *clcont );
+
+    return clcont;
+}
+
+// Resamples destination samples [beg, end) of the subrect on the X axis, Pdst points at sample beg.
+void Resampler::resample_x( Sample* Pdst, const Sample* Psrc, unsigned int beg, unsigned int end )
+{
+    assert( Pdst );
+    assert( Psrc );
+
+    // Identity X axis: just copy.
+    if( m_identity_x )
+    {
+        memcpy( Pdst, Psrc + m_dst_subrect_beg_x + beg, ( end - beg ) * sizeof( Sample ) );
+        return;
+    }
+
+    // Upsampling: use the sliding window kernel for the samples it covers.
+    if( m_upsample_taps && ( beg < m_upsample_end ) && ( end > m_upsample_beg ) )
+    {
+        const unsigned int up_beg = ( beg > m_upsample_beg ) ? beg : m_upsample_beg;
+        const unsigned int up_end = ( end < m_upsample_end ) ? end : m_upsample_end;
+
+        if( beg < up_beg )
+            resample_x( Pdst, Psrc, beg, up_beg );
+        resample_x_upsample( Pdst + ( up_beg - beg ), Psrc, up_beg, up_end );
+        if( up_end < end )
+            resample_x( Pdst + ( up_end - beg ), Psrc, up_end, end );
+        return;
+    }
+
+    Contrib_List *Pclist = m_Pclist_x + beg;
+
+    for( unsigned i = beg; i < end; i++, Pclist++ )
+    {
+        Sample total = 0;
+        Contrib *p = Pclist->p;
+        for( unsigned int j = 0; j < Pclist->n; ++j, ++p )
+        {
+            total += Psrc[ p->pixel ] * p->weight;
+        }
+
+        *Pdst++ = total;
+    }
+}
+
+// Sliding window X axis kernel for upsampling, see init_upsample_x(). The window is the
+// TAPS consecutive source samples starting at each destination sample's first contributor,
+// so there are no pixel indices to load and the source line is walked once, in order.
+template< unsigned int TAPS >
+static void upsample_x( Resampler::Sample* Pdst, const Resampler::Sample* Psrc, const unsigned int* Pbase, const Resample_Real* Pweights, unsigned int n )
+{
+    for( unsigned int i = 0; i < n; i++, Pweights += TAPS )
+    {
+        const Resampler::Sample* Pwindow = Psrc + Pbase[ i ];
+
+        Resampler::Sample total = 0;
+        for( unsigned int t = 0; t < TAPS; t++ )
+            total += Pwindow[ t ] * Pweights[ t ];
+
+        Pdst[ i ] = total;
+    }
+}
+
+void Resampler::resample_x_upsample( Sample* Pdst, const Sample* Psrc, unsigned int beg, unsigned int end )
+{
+    if( beg >= end )
+        return;
+
+    const unsigned int* Pbase = &m_upsample_base[ beg - m_upsample_beg ];
+    const Resample_Real* Pweights = &m_upsample_weights[ ( beg - m_upsample_beg ) * m_upsample_taps ];
+
+    switch( m_upsample_taps )
+    {
+        case 1: upsample_x< 1 >( Pdst, Psrc, Pbase, Pweights, end - beg ); break;
+        case 2: upsample_x< 2 >( Pdst, Psrc, Pbase, Pweights, end - beg ); break;
+        case 3: upsample_x< 3 >( Pdst, Psrc, Pbase, Pweights, end - beg ); break;
+        case 4: upsample_x< 4 >( Pdst, Psrc, Pbase, Pweights, end - beg ); break;
+        case 5: upsample_x< 5 >( Pdst, Psrc, Pbase, Pweights, end - beg ); break;
+        case 6: upsample_x< 6 >( Pdst, Psrc, Pbase, Pweights, end - beg ); break;
+        case 7: upsample_x< 7 >( Pdst, Psrc, Pbase, Pweights, end - beg ); break;
+        case 8: upsample_x< 8 >( Pdst, Psrc, Pbase, Pweights, end - beg ); break;
+        default: assert( 0 ); break;
+    }
+}
+
+// Resamples PUT_LINES_ROWS lines on the X axis at once. Each contributor is loaded once and
+// applied to all the lines, with the partial sums of every line kept in registers.
+void Resampler::resample_x_lines( Sample* const* Pdst, const Sample* const* Psrc )
+{
+    assert( Pdst );
+    assert( Psrc );
+
+    if( m_identity_x )
+    {
+        for( unsigned int r = 0; r < PUT_LINES_ROWS; r++ )
+            resample_x( Pdst[ r ], Psrc[ r ], 0, m_intermediate_x );
+        return;
+    }
+
+    const Sample* Psrc0 = Psrc[ 0 ], *Psrc1 = Psrc[ 1 ], *Psrc2 = Psrc[ 2 ], *Psrc3 = Psrc[ 3 ];
+    Sample* Pdst0 = Pdst[ 0 ], *Pdst1 = Pdst[ 1 ], *Pdst2 = Pdst[ 2 ], *Pdst3 = Pdst[ 3 ];
+
+    const unsigned int dst_w = m_dst_subrect_end_x - m_dst_subrect_beg_x;
+    Contrib_List *Pclist = m_Pclist_x;
+
+    for( unsigned int i = 0; i < dst_w; i++, Pclist++ )
+    {
+        Sample t0 = 0, t1 = 0, t2 = 0, t3 = 0;
+
+        Contrib *p = Pclist->p;
+        for( unsigned int j = 0; j < Pclist->n; ++j, ++p )
+        {
+            const unsigned int pixel = p->pixel;
+            const Resample_Real weight = p->weight;
+            t0 += Psrc0[ pixel ] * weight;
+            t1 += Psrc1[ pixel ] * weight;
+            t2 += Psrc2[ pixel ] * weight;
+            t3 += Psrc3[ pixel ] * weight;
+        }
+
+        Pdst0[ i ] = t0;
+        Pdst1[ i ] = t1;
+        Pdst2[ i ] = t2;
+        Pdst3[ i ] = t3;
+    }
+}
+
+// Resamples n (<= BLOCK_ROWS) lines on the X axis at once. The source columns of each of
+// m_x_tiles are transposed into a tile holding the BLOCK_ROWS samples of each column next to each
+// other, so every contributor becomes a weighted add of one contiguous column instead of a gather
+// per line. The tile stays in the level 1 cache while its destination samples are generated.
+void Resampler::resample_x_block( Sample* const* Pdst, const Sample* const* Psrc, unsigned int n )
+{
+    assert( Pdst );
+    assert( Psrc );
+    assert( ( n > 0 ) && ( n <= BLOCK_ROWS ) );
+
+    if( m_identity_x )
+    {
+        for( unsigned int r = 0; r < n; r++ )
+            resample_x( Pdst[ r ], Psrc[ r ], 0, ( m_dst_subrect_end_x - m_dst_subrect_beg_x ) );
+        return;
+    }
+
+    typedef char block_rows_check[ ( ( int ) BLOCK_ROWS == ( int ) RESAMPLER_SIMD_BLOCK_ROWS ) ? 1 : -1 ];
+    ( void ) sizeof( block_rows_check );
+
+    for( unsigned int t = 0; t < m_x_tiles.size(); t++ )
+    {
+        const Strip& tile = m_x_tiles[ t ];
+
+        if( m_Ptile_buf.size() < ( tile.src_end - tile.src_beg ) * BLOCK_ROWS )
+            m_Ptile_buf.resize( ( tile.src_end - tile.src_beg ) * BLOCK_ROWS );
+
+        Sample* Ptile = &m_Ptile_buf[ 0 ];
+
+        for( unsigned int x = tile.src_beg; x < tile.src_end; x++ )
+        {
+            Sample* Pcol = Ptile + ( x - tile.src_beg ) * BLOCK_ROWS;
+            unsigned int r = 0;
+            for( ; r < n; r++ )
+                Pcol[ r ] = Psrc[ r ][ x ];
+            for( ; r < BLOCK_ROWS; r++ )
+                Pcol[ r ] = 0;
+        }
+
+        Contrib_List *Pclist = m_Pclist_x + tile.dst_beg;
+
+        for( unsigned i = tile.dst_beg; i < tile.dst_end; i++, Pclist++ )
+        {
+            Sample total[ BLOCK_ROWS ];
+
+            if( g_Psimd )
+                g_Psimd->block_x( total, Ptile, tile.src_beg, Pclist->p, Pclist->n );
+            else
+            {
+                for( unsigned int r = 0; r < BLOCK_ROWS; r++ )
+                    total[ r ] = 0;
+
+                Contrib *p = Pclist->p;
+                for( unsigned int j = 0; j < Pclist->n; ++j, ++p )
+                {
+                    const Sample* Pcol = Ptile + ( p->pixel - tile.src_beg ) * BLOCK_ROWS;
+                    const Resample_Real weight = p->weight;
+                    for( unsigned int r = 0; r < BLOCK_ROWS; r++ )
+                        total[ r ] += Pcol[ r ] * weight;
+                }
+            }
+
+            for( unsigned int r = 0; r < n; r++ )
+                Pdst[ r ][ i ] = total[ r ];
+        }
+    }
+}
+
+void Resampler::scale_y_mov( Sample* Ptmp, const Sample* Psrc, Resample_Real weight, unsigned int dst_w )
+{
+    if( g_Psimd )
+    {
+        g_Psimd->scale_y_mov( Ptmp, Psrc, weight, dst_w );
+        return;
+    }
+
+    // Not += because temp buf wasn't cleared.
+    for( unsigned int i = 0; i < dst_w; i++ )
+        *Ptmp++ = *Psrc++ *weight;
+}
+
+void Resampler::scale_y_add( Sample* Ptmp, const Sample* Psrc, Resample_Real weight, unsigned int dst_w )
+{
+    if( g_Psimd )
+    {
+        g_Psimd->scale_y_add( Ptmp, Psrc, weight, dst_w );
+        return;
+    }
+
+    for( unsigned int i = 0; i < dst_w; i++ )
+        ( *Ptmp++ ) += *Psrc++ *weight;
+}
+
+void Resampler::clamp( Sample* Pdst, unsigned int n, Resample_Real lo, Resample_Real hi )
+{
+    if( g_Psimd )
+    {
+        g_Psimd->clamp( Pdst, n, lo, hi );
+        return;
+    }
+
+    for( unsigned int i = 0; i < n; ++i )
+    {
+        *Pdst = clamp_sample( *Pdst, lo, hi );
+        ++Pdst;
+    }
+}
+
+// Looks up the scan buffer lines contributing to the current destination line.
+void Resampler::find_y_lines()
+{
+    const Contrib_List* Pclist = &clist_y( m_cur_dst_y );
+
+    m_Psrc_y_lines.resize( Pclist->n );
+
+    for( int i = 0; i < Pclist->n; i++ )
+    {
+        // locate the contributor's location in the scan
+        // buffer -- the contributor must always be found!
+
+        // Spilled lines are read back by accumulate_y().
+        if( m_spill_slots.count( Pclist->p[ i ].pixel ) )
+        {
+            m_Psrc_y_lines[ i ] = NULL;
+            continue;
+        }
+
+        std::vector< Sample >& scan_buf = m_Pscan_buf[ Pclist->p[ i ].pixel ];
+        assert( !scan_buf.empty() );
+        m_Psrc_y_lines[ i ] = &scan_buf[ 0 ];
+    }
+}
+
+// Sums intermediate samples [beg, end) of the lines found by find_y_lines() into Ptmp, one
+// strip at a time so the partial sums stay in cache while every contributor is added.
+void Resampler::accumulate_y( Sample* Ptmp, unsigned int beg, unsigned int end )
+{
+    const Contrib_List* Pclist = &clist_y( m_cur_dst_y );
+
+    assert( Ptmp );
+
+    for( unsigned int strip_beg = beg; strip_beg < end; strip_beg += m_strip_w )
+    {
+        const unsigned int strip_w = ( ( end - strip_beg ) < m_strip_w ) ? ( end - strip_beg ) : m_strip_w;
+
+        // Process each contributor.
+        for( int i = 0; i < Pclist->n; i++ )
+        {
+            const Sample* Psrc = m_Psrc_y_lines[ i ] ? ( m_Psrc_y_lines[ i ] + strip_beg ) :
+                                 ( read_spilled_line( Pclist->p[ i ].pixel, strip_beg, strip_w ) + strip_beg );
+
+            if( !i )
+                scale_y_mov( Ptmp + strip_beg, Psrc, Pclist->p[ i ].weight, strip_w );
+            else
+                scale_y_add( Ptmp + strip_beg, Psrc, Pclist->p[ i ].weight, strip_w );
+        }
+    }
+}
+
+// Finds the runs of at least MIN_CONST_RUN equal samples.
+void Resampler::find_const_spans( const Sample* Psrc, unsigned int n, std::vector< Const_Span >& spans )
+{
+    spans.clear();
+
+    unsigned int i = 0;
+    while( i < n )
+    {
+        const Sample value = Psrc[ i ];
+        unsigned int j = i + 1;
+        while( ( j < n ) && ( Psrc[ j ] == value ) )
+            j++;
+
+        if( j - i >= MIN_CONST_RUN )
+        {
+            Const_Span span = { i, j, value };
+            spans.push_back( span );
+        }
+        i = j;
+    }
+}
+
+// resample_x(), except that destination samples whose contributors all fall inside one of the
+// source line's constant spans are set to its value.
+void Resampler::resample_x_const( Sample* Pdst, const Sample* Psrc, const std::vector< Const_Span >& spans, unsigned int beg, unsigned int end )
+{
+    if( m_identity_x || spans.empty() )
+    {
+        resample_x( Pdst, Psrc, beg, end );
+        m_stats.filtered_samples += end - beg;
+        return;
+    }
+
+    unsigned int s = 0;
+    unsigned int filter_beg = beg;
+    unsigned int num_const = 0;
+    for( unsigned int i = beg; i < end; i++ )
+    {
+        const unsigned int lo = m_clist_x_lo[ i ], hi = m_clist_x_hi[ i ];
+
+        // The last span starting at or before lo. The lists move right, so this rarely goes back.
+        while( ( s + 1 < spans.size() ) && ( spans[ s + 1 ].beg <= lo ) )
+            s++;
+        while( ( s > 0 ) && ( spans[ s ].beg > lo ) )
+            s--;
+
+        const Const_Span& span = spans[ s ];
+        if( ( lo > hi ) || ( span.beg > lo ) || ( hi >= span.end ) )
+            continue;
+
+        if( filter_beg < i )
+            resample_x( Pdst + ( filter_beg - beg ), Psrc, filter_beg, i );
+        Pdst[ i - beg ] = span.value;
+        filter_beg = i + 1;
+        num_const++;
+    }
+
+    if( filter_beg < end )
+        resample_x( Pdst + ( filter_beg - beg ), Psrc, filter_beg, end );
+
+    m_stats.const_samples += num_const;
+    m_stats.filtered_samples += ( end - beg ) - num_const;
+}
+
+// Intersects the constant spans of the current destination line's Y contributors into m_y_spans,
+// keeping the parts where they all have the same value.
+void Resampler::find_y_const_spans()
+{
+    const Contrib_List* Pclist = &clist_y( m_cur_dst_y );
+
+    m_y_spans.clear();
+
+    for( int i = 0; i < Pclist->n; i++ )
+    {
+        std::map< int, std::vector< Const_Span > >::const_iterator it = m_const_spans.find( Pclist->p[ i ].pixel );
+        if( ( it == m_const_spans.end() ) || it->second.empty() )
+        {
+            m_y_spans.clear();
+            return;
+        }
+
+        const std::vector< Const_Span >& spans = it->second;
+        if( !i )
+        {
+            m_y_spans = spans;
+            continue;
+        }
+
+        m_tmp_spans.clear();
+        unsigned int a = 0, b = 0;
+        while( ( a < m_y_spans.size() ) && ( b < spans.size() ) )
+        {
+            const unsigned int lo = std::max( m_y_spans[ a ].beg, spans[ b ].beg );
+            const unsigned int hi = std::min( m_y_spans[ a ].end, spans[ b ].end );
+            if( ( lo < hi ) && ( m_y_spans[ a ].value == spans[ b ].value ) )
+            {
+                Const_Span span = { lo, hi, spans[ b ].value };
+                m_tmp_spans.push_back( span );
+            }
+
+            if( m_y_spans[ a ].end < spans[ b ].end )
+                a++;
+            else
+                b++;
+        }
+        m_y_spans.swap( m_tmp_spans );
+
+        if( m_y_spans.empty() )
+            return;
+    }
+}
+
+// accumulate_y(), except that the samples inside m_y_spans are set to the span's value.
+void Resampler::accumulate_y_const( Sample* Ptmp, unsigned int beg, unsigned int end )
+{
+    unsigned int filter_beg = beg;
+    unsigned int num_const = 0;
+    for( unsigned int i = 0; i < m_y_spans.size(); i++ )
+    {
+        const unsigned int lo = std::max( m_y_spans[ i ].beg, beg );
+        const unsigned int hi = std::min( m_y_spans[ i ].end, end );
+        if( lo >= hi )
+            continue;
+
+        if( filter_beg < lo )
+            accumulate_y( Ptmp, filter_beg, lo );
+        std::fill( Ptmp + lo, Ptmp + hi, m_y_spans[ i ].value );
+        num_const += hi - lo;
+        filter_beg = hi;
+    }
+
+    if( filter_beg < end )
+        accumulate_y( Ptmp, filter_beg, end );
+
+    m_stats.const_samples += num_const;
+    m_stats.filtered_samples += ( end - beg ) - num_const;
+}
+
+void Resampler::release_y_lines()
+{
+    const Contrib_List* Pclist = &clist_y( m_cur_dst_y );
+
+    for( int i = 0; i < Pclist->n; i++ )
+    {
+        // If this source line doesn't contribute to any
+        // more destination lines then mark the scanline buffer slot
+        // which holds this source line as free.
+        // (The max. number of slots used depends on the Y
+        //  axis sampling factor and the scaled filter width.)
+        if( --m_Psrc_y_count[ Pclist->p[ i ].pixel ] == 0 )
+        {
+            m_Psrc_y_flag[ Pclist->p[ i ].pixel ] = false;
+            m_Pscan_buf.erase( Pclist->p[ i ].pixel );
+            m_const_spans.erase( Pclist->p[ i ].pixel );
+
+            std::map< int, unsigned int >::iterator it = m_spill_slots.find( Pclist->p[ i ].pixel );
+            if( it != m_spill_slots.end() )
+            {
+                m_free_spill_slots.push_back( it->second );
+                m_spill_slots.erase( it );
+            }
+        }
+    }
+}
+
+void Resampler::resample_y( Sample* Pdst )
+{
+    if( m_identity_y )
+    {
+        // Identity Y axis: the destination line is the X resampled source line.
+        assert( !m_delay_x_resample );
+
+        const int src_y = clist_y( m_cur_dst_y ).p[ 0 ].pixel;
+
+        if( m_pass_ready )
+        {
+            // Put straight through by put_line(), nothing was buffered.
+            if( Pdst == &m_Pdst_buf[ 0 ] )
+            {
+                m_Pdst_buf.swap( m_pass_buf );
+                Pdst = &m_Pdst_buf[ 0 ];
+            }
+            else
+                memcpy( Pdst, &m_pass_buf[ 0 ], m_intermediate_x * sizeof( Sample ) );
+            m_pass_ready = false;
+
+            if( m_lo < m_hi )
+                clamp( Pdst, ( m_dst_subrect_end_x - m_dst_subrect_beg_x ), m_lo, m_hi );
+            return;
+        }
+
+        if( m_spill_slots.count( src_y ) )
+            memcpy( Pdst, read_spilled_line( src_y, 0, m_intermediate_x ), m_intermediate_x * sizeof( Sample ) );
+        else
+        {
+            std::vector< Sample >& scan_buf = m_Pscan_buf[ src_y ];
+            assert( scan_buf.size() == m_Pdst_buf.size() );
+
+            if( Pdst == &m_Pdst_buf[ 0 ] )
+            {
+                // Hand the line over to get_line() instead of copying it.
+                m_Pdst_buf.swap( scan_buf );
+                Pdst = &m_Pdst_buf[ 0 ];
+            }
+            else
+                memcpy( Pdst, &scan_buf[ 0 ], m_intermediate_x * sizeof( Sample ) );
+        }
+
+        release_y_lines();
+
+        if( m_lo < m_hi )
+            clamp( Pdst, ( m_dst_subrect_end_x - m_dst_subrect_beg_x ), m_lo, m_hi );
+        return;
+    }
+
+    if( m_scatter_y )
+    {
+        // The partial sums are complete.
+        std::vector< Sample >& accum = m_Paccum_buf[ m_cur_dst_y ];
+        assert( accum.size() == m_intermediate_x );
+
+        if( m_delay_x_resample )
+            resample_x( Pdst, &accum[ 0 ], 0, ( m_dst_subrect_end_x - m_dst_subrect_beg_x ) );
+        else if( Pdst == &m_Pdst_buf[ 0 ] )
+        {
+            m_Pdst_buf.swap( accum );
+            Pdst = &m_Pdst_buf[ 0 ];
+        }
+        else
+            memcpy( Pdst, &accum[ 0 ], m_intermediate_x * sizeof( Sample ) );
+
+        m_Paccum_buf.erase( m_cur_dst_y );
+
+        if( m_lo < m_hi )
+            clamp( Pdst, ( m_dst_subrect_end_x - m_dst_subrect_beg_x ), m_lo, m_hi );
+        return;
+    }
+
+    Sample* Ptmp = m_delay_x_resample ? &m_Ptmp_buf[ 0 ] : Pdst;
+
+    find_y_lines();
+
+    if( m_skip_constant )
+    {
+        find_y_const_spans();
+
+        if( m_delay_x_resample )
+        {
+            assert( Pdst != Ptmp );
+            accumulate_y_const( Ptmp, 0, m_intermediate_x );
+            resample_x_const( Pdst, Ptmp, m_y_spans, 0, ( m_dst_subrect_end_x - m_dst_subrect_beg_x ) );
+        }
+        else
+            accumulate_y_const( Ptmp, 0, m_intermediate_x );
+    }
+    // Was X resampling delayed until after Y resampling?
+    else if( m_delay_x_resample )
+    {
+        assert( Pdst != Ptmp );
+
+        if( !m_strips.empty() )
+        {
+            // Only sum the intermediate samples each strip of destination samples needs,
+            // then resample that strip on the X axis while they're still in cache.
+            for( unsigned int i = 0; i < m_strips.size(); i++ )
+            {
+                const Strip& strip = m_strips[ i ];
+                accumulate_y( Ptmp, strip.src_beg, strip.src_end );
+                resample_x( Pdst + strip.dst_beg, Ptmp, strip.dst_beg, strip.dst_end );
+            }
+        }
+        else
+        {
+            accumulate_y( Ptmp, 0, m_intermediate_x );
+            resample_x( Pdst, Ptmp, 0, ( m_dst_subrect_end_x - m_dst_subrect_beg_x ) );
+        }
+    }
+    else
+    {
+        assert( Pdst == Ptmp );
+        accumulate_y( Ptmp, 0, m_intermediate_x );
+    }
+
+    release_y_lines();
+
+    if( m_lo < m_hi )
+        clamp( Pdst, ( m_dst_subrect_end_x - m_dst_subrect_beg_x ), m_lo, m_hi );
+}
+
+// Writes m_spill_line, source line src_y, to the spill file. The file is created on first use,
+// and the slots of released lines are reused.
+bool Resampler::spill_line( int src_y )
+{
+    if( !m_Pspill_file )
+    {
+        m_Pspill_file = tmpfile();
+        if( !m_Pspill_file )
+            return false;
+    }
+
+    unsigned int slot;
+    if( !m_free_spill_slots.empty() )
+    {
+        slot = m_free_spill_slots.back();
+        m_free_spill_slots.pop_back();
+    }
+    else
+        slot = m_num_spill_slots++;
+
+    const size_t line_size = m_intermediate_x * sizeof( Sample );
+    if( !seek_file( m_Pspill_file, ( unsigned long long ) slot * line_size ) ||
+        ( fwrite( &m_spill_line[ 0 ], 1, line_size, m_Pspill_file ) != line_size ) )
+    {
+        m_free_spill_slots.push_back( slot );
+        return false;
+    }
+
+    m_spill_slots[ src_y ] = slot;
+    m_stats.spilled_lines++;
+    return true;
+}
+
+// Reads samples [beg, beg + n) of spilled source line src_y into m_spill_line, and returns m_spill_line.
+// A failed read gives zeros, and sets the status to STATUS_SCAN_BUFFER_FULL.
+const Resampler::Sample* Resampler::read_spilled_line( int src_y, unsigned int beg, unsigned int n )
+{
+    assert( m_spill_slots.count( src_y ) );
+
+    m_spill_line.resize( m_intermediate_x );
+
+    const unsigned long long ofs = ( unsigned long long ) m_spill_slots[ src_y ] * m_intermediate_x + beg;
+    if( !seek_file( m_Pspill_file, ofs * sizeof( Sample ) ) ||
+        ( fread( &m_spill_line[ beg ], sizeof( Sample ), n, m_Pspill_file ) != n ) )
+    {
+        memset( &m_spill_line[ beg ], 0, n * sizeof( Sample ) );
+        m_status = STATUS_SCAN_BUFFER_FULL;
+    }
+
+    return &m_spill_line[ 0 ];
+}
+
+bool Resampler::put_line( const Sample* Psrc )
+{
+    // Queue the line while the contributor lists are being built. A continuous stream is bounded
+    // by the lists, so it waits for them.
+    if( !clists_ready( m_continuous_y ) )
+    {
+        if( m_pending_lines.size() >= m_resample_src_h )
+            return false;
+        m_pending_lines.push_back( std::vector< Sample >( Psrc, Psrc + m_resample_src_w ) );
+        return true;
+    }
+
+    if( m_status != STATUS_OKAY )
+        return false;
+
+    next_period();
+
+    if( m_cur_src_y >= m_src_y_end )
+        return false;
+
+    // Does this source line contribute to any destination line?  if not, exit now.
+    if( !m_Psrc_y_count[ m_cur_src_y ] )
+    {
+        m_cur_src_y++;
+        return true;
+    }
+
+    if( m_scatter_y )
+    {
+        scatter_y( Psrc );
+        m_cur_src_y++;
+        return true;
+    }
+
+    // Identity Y axis: if this is the next line get_line() returns, resample it on the X axis
+    // straight into m_pass_buf. Lines put ahead of get_line() are buffered below.
+    if( m_identity_y && ( m_cur_src_y == m_cur_dst_y ) )
+    {
+        m_pass_buf.resize( m_intermediate_x );
+        if( m_skip_constant )
+        {
+            find_const_spans( Psrc, m_resample_src_w, m_src_spans );
+            resample_x_const( &m_pass_buf[ 0 ], Psrc, m_src_spans, 0, m_intermediate_x );
+        }
+        else
+            resample_x( &m_pass_buf[ 0 ], Psrc, 0, m_intermediate_x );
+
+        m_pass_ready = true;
+        m_cur_src_y++;
+        return true;
+    }
+
+    // Find an empty slot in the scanline buffer, or spill the line to disk if the buffer is full.
+    const bool spill = ( m_max_scan_buf_size > 0 ) &&
+                       ( ( double ) ( m_Pscan_buf.size() + 1 ) * m_intermediate_x * sizeof( Sample ) > ( double ) m_max_scan_buf_size );
+    Sample* Pline;
+    if( spill )
+    {
+        m_spill_line.resize( m_intermediate_x );
+        Pline = &m_spill_line[ 0 ];
+    }
+    else
+    {
+        std::vector< Sample >& scan_buf = m_Pscan_buf[ m_cur_src_y ];
+        scan_buf.resize( m_intermediate_x );
+        Pline = &scan_buf[ 0 ];
+    }
+
+    // Resampling on the X axis first?
+    if( m_delay_x_resample )
+    {
+        // Y-X resampling order, only the source columns the subrect needs.
+        std::copy( Psrc + m_src_x_beg, Psrc + m_src_x_beg + m_intermediate_x, Pline );
+    }
+    else
+    {
+        assert( m_intermediate_x == ( m_dst_subrect_end_x - m_dst_subrect_beg_x ) );
+
+        // X-Y resampling order
+        if( m_skip_constant )
+        {
+            find_const_spans( Psrc, m_resample_src_w, m_src_spans );
+            resample_x_const( Pline, Psrc, m_src_spans, 0, m_intermediate_x );
+        }
+        else
+            resample_x( Pline, Psrc, 0, m_intermediate_x );
+    }
+
+    if( m_skip_constant )
+        find_const_spans( Pline, m_intermediate_x, m_const_spans[ m_cur_src_y ] );
+
+    if( spill && !spill_line( m_cur_src_y ) )
+    {
+        m_status = STATUS_SCAN_BUFFER_FULL;
+        return false;
+    }
+
+    m_Psrc_y_flag[ m_cur_src_y ] = true;
+
+    m_cur_src_y++;
+
+    return true;
+}
+
+bool Resampler::put_lines( const Sample* Psrc, unsigned int count, unsigned int src_pitch )
+{
+    if( !clists_ready( m_continuous_y ) )
+    {
+        if( count > m_resample_src_h - m_pending_lines.size() )
+            return false;
+        for( unsigned int i = 0; i < count; i++ )
+            put_line( Psrc + ( size_t ) i * src_pitch );
+        return true;
+    }
+
+    if( m_status != STATUS_OKAY )
+        return false;
+
+    next_period();
+
+    if( count > m_src_y_end - m_cur_src_y )
+        return false;
+
+    // Y-X resampling order: the lines are just copied into the scan buffer. Lines may also need
+    // spilling to disk, which put_line() takes care of.
+    if( m_delay_x_resample || m_max_scan_buf_size || m_scatter_y || m_skip_constant )
+    {
+        for( unsigned int i = 0; i < count; i++ )
+            if( !put_line( Psrc + ( size_t ) i * src_pitch ) )
+                return false;
+        return true;
+    }
+
+    // X-Y resampling order: resample the contributing lines on the X axis PUT_LINES_ROWS at a time.
+    const Sample* Psrc_lines[ PUT_LINES_ROWS ];
+    Sample* Pdst_lines[ PUT_LINES_ROWS ];
+    unsigned int n = 0;
+
+    for( unsigned int i = 0; i < count; i++, m_cur_src_y++ )
+    {
+        if( !m_Psrc_y_count[ m_cur_src_y ] )
+            continue;
+
+        m_Psrc_y_flag[ m_cur_src_y ] = true;
+        std::vector< Sample >& scan_buf = m_Pscan_buf[ m_cur_src_y ];
+        scan_buf.resize( m_intermediate_x );
+
+        Psrc_lines[ n ] = Psrc + ( size_t ) i * src_pitch;
+        Pdst_lines[ n ] = &scan_buf[ 0 ];
+
+        if( ++n == PUT_LINES_ROWS )
+        {
+            resample_x_lines( Pdst_lines, Psrc_lines );
+            n = 0;
+        }
+    }
+
+    for( unsigned int i = 0; i < n; i++ )
+        resample_x( Pdst_lines[ i ], Psrc_lines[ i ], 0, m_intermediate_x );
+
+    return true;
+}
+
+// true if all the source lines contributing to destination line dst_y are present.
+bool Resampler::line_ready( unsigned int dst_y ) const
+{
+    // If all the destination lines have been generated, then always return false.
+    if( dst_y >= m_dst_subrect_end_y )
+        return false;
+
+    if( m_scatter_y )
+        return m_dst_y_count[ dst_y - m_dst_subrect_beg_y ] == 0;
+
+    if( m_pass_ready && ( dst_y == m_cur_dst_y ) )
+        return true;
+
+    const Contrib_List& clist = clist_y( dst_y );
+    for( unsigned int i = 0; i < clist.n; i++ )
+        if( !m_Psrc_y_flag[ clist.p[ i ].pixel ] )
+            return false;
+
+    return true;
+}
+
+const Resampler::Sample* Resampler::get_line()
+{
+    clists_ready( true );
+    next_period();
+
+    // Check to see if all the required contributors are present, if not, return NULL.
+    if( !line_ready( m_cur_dst_y ) )
+        return NULL;
+
+    resample_y( &m_Pdst_buf[ 0 ] );
+
+    m_cur_dst_y++;
+
+    return &m_Pdst_buf[ 0 ];
+}
+
+// Sums the source lines contributing to the k destination lines starting at m_cur_dst_y
+// into Ptmp[0..k-1]. Each source line is read once per sweep and added to every destination
+// line it contributes to, instead of being read again for each destination line.
+// The contributor lists must list their source lines in increasing order, so every
+// destination line still sums its contributors in the same order as accumulate_y().
+void Resampler::accumulate_y_lines( Sample* const* Ptmp, unsigned int k )
+{
+    assert( ( k > 0 ) && ( k <= MAX_SWEEP_LINES ) );
+
+    // Merge the contributor lists.
+    m_sweep.clear();
+    for( unsigned int j = 0; j < k; j++ )
+    {
+        const Contrib_List& clist = clist_y( m_cur_dst_y + j );
+        for( unsigned int i = 0; i < clist.n; i++ )
+        {
+            Sweep_Contrib c;
+            c.src_y = clist.p[ i ].pixel;
+            c.line = j;
+            c.weight = clist.p[ i ].weight;
+            m_sweep.push_back( c );
+        }
+    }
+    // Order by source line. The sort is stable, so each destination line keeps the order of its contributors.
+    std::stable_sort( m_sweep.begin(), m_sweep.end(), sweep_less );
+
+    m_Psrc_y_lines.resize( m_sweep.size() );
+    for( unsigned int i = 0; i < m_sweep.size(); i++ )
+    {
+        if( i && ( m_sweep[ i ].src_y == m_sweep[ i - 1 ].src_y ) )
+            m_Psrc_y_lines[ i ] = m_Psrc_y_lines[ i - 1 ];
+        else if( m_spill_slots.count( m_sweep[ i ].src_y ) )
+            m_Psrc_y_lines[ i ] = NULL;
+        else
+        {
+            std::vector< Sample >& scan_buf = m_Pscan_buf[ m_sweep[ i ].src_y ];
+            assert( !scan_buf.empty() );
+            m_Psrc_y_lines[ i ] = &scan_buf[ 0 ];
+        }
+    }
+
+    for( unsigned int j = 0; j < k; j++ )
+        memset( Ptmp[ j ], 0, m_intermediate_x * sizeof( Sample ) );
+
+    // Keep all k strips of partial sums in the level 1 cache.
+    unsigned int chunk_w = SWEEP_CHUNK_W;
+    if( ( m_strip_w < m_intermediate_x ) && ( m_strip_w / k < chunk_w ) )
+        chunk_w = ( m_strip_w / k + 15 ) & ~15U;
+
+    for( unsigned int beg = 0; beg < m_intermediate_x; beg += chunk_w )
+    {
+        const unsigned int n = ( ( m_intermediate_x - beg ) < chunk_w ) ? ( m_intermediate_x - beg ) : chunk_w;
+
+        unsigned int i = 0;
+        while( i < m_sweep.size() )
+        {
+            // Gather the destination lines (at most MAX_SWEEP_LINES) this source line contributes to.
+            Sample* Plines[ MAX_SWEEP_LINES ];
+            Resample_Real weights[ MAX_SWEEP_LINES ];
+            unsigned int num = 0;
+            const Sample* Psrc = m_Psrc_y_lines[ i ] ? m_Psrc_y_lines[ i ] : read_spilled_line( m_sweep[ i ].src_y, beg, n );
+            do
+            {
+                Plines[ num ] = Ptmp[ m_sweep[ i ].line ];
+                weights[ num ] = m_sweep[ i ].weight;
+                num++;
+                i++;
+            } while( ( i < m_sweep.size() ) && ( m_sweep[ i ].src_y == m_sweep[ i - 1 ].src_y ) && ( num < MAX_SWEEP_LINES ) );
+
+            scale_y_add_lines( Plines, weights, num, Psrc, beg, n );
+        }
+    }
+}
+
+// Adds Psrc[beg, beg + n) * weights[j] to Ptmp[j][beg, beg + n) for num destination lines.
+void Resampler::scale_y_add_lines( Sample* const* Ptmp, const Resample_Real* weights, unsigned int num, const Sample* Psrc, unsigned int beg, unsigned int n )
+{
+    if( g_Psimd && ( num <= MAX_SWEEP_LINES ) )
+    {
+        Sample* Plines[ MAX_SWEEP_LINES ];
+        for( unsigned int j = 0; j < num; j++ )
+            Plines[ j ] = Ptmp[ j ] + beg;
+        g_Psimd->scale_y_add_lines( Plines, weights, num, Psrc + beg, n );
+        return;
+    }
+
+    Psrc += beg;
+
+    switch( num )
+    {
+        case 4:
+        {
+            Sample* P0 = Ptmp[ 0 ] + beg, *P1 = Ptmp[ 1 ] + beg, *P2 = Ptmp[ 2 ] + beg, *P3 = Ptmp[ 3 ] + beg;
+            const Resample_Real w0 = weights[ 0 ], w1 = weights[ 1 ], w2 = weights[ 2 ], w3 = weights[ 3 ];
+            for( unsigned int i = 0; i < n; i++ )
+            {
+                const Sample s = Psrc[ i ];
+                P0[ i ] += s * w0;
+                P1[ i ] += s * w1;
+                P2[ i ] += s * w2;
+                P3[ i ] += s * w3;
+            }
+            break;
+        }
+        case 3:
+        {
+            Sample* P0 = Ptmp[ 0 ] + beg, *P1 = Ptmp[ 1 ] + beg, *P2 = Ptmp[ 2 ] + beg;
+            const Resample_Real w0 = weights[ 0 ], w1 = weights[ 1 ], w2 = weights[ 2 ];
+            for( unsigned int i = 0; i < n; i++ )
+            {
+                const Sample s = Psrc[ i ];
+                P0[ i ] += s * w0;
+                P1[ i ] += s * w1;
+                P2[ i ] += s * w2;
+            }
+            break;
+        }
+        case 2:
+        {
+            Sample* P0 = Ptmp[ 0 ] + beg, *P1 = Ptmp[ 1 ] + beg;
+            const Resample_Real w0 = weights[ 0 ], w1 = weights[ 1 ];
+            for( unsigned int i = 0; i < n; i++ )
+            {
+                const Sample s = Psrc[ i ];
+                P0[ i ] += s * w0;
+                P1[ i ] += s * w1;
+            }
+            break;
+        }
+        default:
+        {
+            for( unsigned int j = 0; j < num; j++ )
+                scale_y_add( Ptmp[ j ] + beg, Psrc, weights[ j ], n );
+            break;
+        }
+    }
+}
+
+// true if the contributor list of destination line dst_y lists its source lines in
+// increasing order, which is the case everywhere but near the edges with BOUNDARY_REFLECT or BOUNDARY_WRAP.
+bool Resampler::clist_y_sorted( unsigned int dst_y ) const
+{
+    const Contrib_List& clist = clist_y( dst_y );
+    for( unsigned int i = 1; i < clist.n; i++ )
+        if( clist.p[ i ].pixel < clist.p[ i - 1 ].pixel )
+            return false;
+    return true;
+}
+
+unsigned int Resampler::get_lines( Sample* Pdst, unsigned int dst_pitch, unsigned int max_lines )
+{
+    const unsigned int dst_w = m_dst_subrect_end_x - m_dst_subrect_beg_x;
+
+    clists_ready( true );
+
+    unsigned int total = 0;
+    while( total < max_lines )
+    {
+        next_period();
+        if( !line_ready( m_cur_dst_y ) )
+            break;
+
+        unsigned int k = 0;
+        while( ( !m_identity_y ) && ( !m_scatter_y ) && ( !m_skip_constant ) && ( k < MAX_SWEEP_LINES ) && ( total + k < max_lines ) &&
+               line_ready( m_cur_dst_y + k ) && clist_y_sorted( m_cur_dst_y + k ) )
+            k++;
+
+        Sample* Pdst_lines[ MAX_SWEEP_LINES ];
+        for( unsigned int j = 0; j < k; j++ )
+            Pdst_lines[ j ] = Pdst + ( size_t ) ( total + j ) * dst_pitch;
+
+        if( k <= 1 )
+        {
+            // Nothing to share, or the contributors are out of order: generate a single line.
+            resample_y( Pdst + ( size_t ) total * dst_pitch );
+            m_cur_dst_y++;
+            total++;
+            continue;
+        }
+
+        Sample* Ptmp_lines[ MAX_SWEEP_LINES ];
+        if( m_delay_x_resample )
+        {
+            if( m_Ptmp_buf.size() < m_intermediate_x * MAX_SWEEP_LINES )
+                m_Ptmp_buf.resize( m_intermediate_x * MAX_SWEEP_LINES );
+            for( unsigned int j = 0; j < k; j++ )
+                Ptmp_lines[ j ] = &m_Ptmp_buf[ j * m_intermediate_x ];
+        }
+        else
+        {
+            for( unsigned int j = 0; j < k; j++ )
+                Ptmp_lines[ j ] = Pdst_lines[ j ];
+        }
+
+        accumulate_y_lines( Ptmp_lines, k );
+
+        for( unsigned int j = 0; j < k; j++, m_cur_dst_y++ )
+            release_y_lines();
+
+        if( m_delay_x_resample )
+            resample_x_block( Pdst_lines, Ptmp_lines, k );
+
+        if( m_lo < m_hi )
+        {
+            for( unsigned int j = 0; j < k; j++ )
+                clamp( Pdst_lines[ j ], dst_w, m_lo, m_hi );
+        }
+
+        total += k;
+    }
+
+    return total;
+}
+
+bool Resampler::resample_image( const Sample* Psrc, unsigned int src_pitch, Sample* Pdst, unsigned int dst_pitch )
+{
+    clists_ready( true );
+
+    if( ( m_status != STATUS_OKAY ) || ( m_cur_src_y != 0 ) || m_continuous_y )
+        return false;
+
+    const unsigned int dst_w = m_dst_subrect_end_x - m_dst_subrect_beg_x;
+
+    const Sample* Psrc_lines[ BLOCK_ROWS ];
+    Sample* Pdst_lines[ BLOCK_ROWS ];
+    unsigned int n = 0;
+
+    if( m_max_scan_buf_size || m_scatter_y || m_skip_constant )
+    {
+        // Lines may have to be spilled to disk, are scattered, or have constant regions: go
+        // through put_line() and resample_y(), which take care of that.
+        for( unsigned int src_y = 0; src_y < m_resample_src_h; src_y++ )
+        {
+            if( !put_line( Psrc + ( size_t ) src_y * src_pitch ) )
+                return false;
+
+            while( line_ready( m_cur_dst_y ) )
+            {
+                resample_y( Pdst + ( size_t ) ( m_cur_dst_y - m_dst_subrect_beg_y ) * dst_pitch );
+                m_cur_dst_y++;
+            }
+        }
+    }
+    else if( !m_delay_x_resample )
+    {
+        // X-Y resampling order: resample blocks of contributing source lines on the X axis,
+        // then generate every destination line the block completed.
+        while( m_cur_src_y < m_resample_src_h )
+        {
+            n = 0;
+            for( ; ( m_cur_src_y < m_resample_src_h ) && ( n < BLOCK_ROWS ); m_cur_src_y++ )
+            {
+                if( !m_Psrc_y_count[ m_cur_src_y ] )
+                    continue;
+
+                Psrc_lines[ n ] = Psrc + ( size_t ) m_cur_src_y * src_pitch;
+                if( m_identity_y )
+                {
+                    // Source line y is destination line y.
+                    Pdst_lines[ n ] = Pdst + ( size_t ) ( m_cur_src_y - m_dst_subrect_beg_y ) * dst_pitch;
+                }
+                else
+                {
+                    std::vector< Sample >& scan_buf = m_Pscan_buf[ m_cur_src_y ];
+                    scan_buf.resize( m_intermediate_x );
+                    m_Psrc_y_flag[ m_cur_src_y ] = true;
+                    Pdst_lines[ n ] = &scan_buf[ 0 ];
+                }
+                n++;
+            }
+
+            if( n )
+                resample_x_block( Pdst_lines, Psrc_lines, n );
+
+            if( m_identity_y )
+            {
+                if( m_lo < m_hi )
+                {
+                    for( unsigned int r = 0; r < n; r++ )
+                        clamp( Pdst_lines[ r ], dst_w, m_lo, m_hi );
+                }
+                m_cur_dst_y += n;
+                continue;
+            }
+
+            while( line_ready( m_cur_dst_y ) )
+            {
+                resample_y( Pdst + ( size_t ) ( m_cur_dst_y - m_dst_subrect_beg_y ) * dst_pitch );
+                m_cur_dst_y++;
+            }
+        }
+    }
+    else
+    {
+        // Y-X resampling order: resample the destination lines on the Y axis into a block of
+        // intermediate lines, then resample the whole block on the X axis.
+        std::vector< Sample > tmp_block( m_intermediate_x * BLOCK_ROWS );
+
+        for( unsigned int src_y = 0; src_y < m_resample_src_h; src_y++ )
+        {
+            if( !put_line( Psrc + ( size_t ) src_y * src_pitch ) )
+                return false;
+
+            while( line_ready( m_cur_dst_y ) )
+            {
+                Sample* Ptmp = &tmp_block[ n * m_intermediate_x ];
+                find_y_lines();
+                accumulate_y( Ptmp, 0, m_intermediate_x );
+                release_y_lines();
+
+                Psrc_lines[ n ] = Ptmp;
+                Pdst_lines[ n ] = Pdst + ( size_t ) ( m_cur_dst_y - m_dst_subrect_beg_y ) * dst_pitch;
+                m_cur_dst_y++;
+
+                if( ( ++n == BLOCK_ROWS ) || ( m_cur_dst_y == m_dst_subrect_end_y ) )
+                {
+                    resample_x_block( Pdst_lines, Psrc_lines, n );
+
+                    if( m_lo < m_hi )
+                    {
+                        for( unsigned int r = 0; r < n; r++ )
+                            clamp( Pdst_lines[ r ], dst_w, m_lo, m_hi );
+                    }
+
+                    n = 0;
+                }
+            }
+        }
+    }
+
+    assert( m_cur_dst_y == m_dst_subrect_end_y );
+
+    return true;
+}
+
+// What build_clists() needs to build the contributor lists, and the background thread doing it.
+struct Resampler::Clist_Builder
+{
+    Filter filter;
+    Resample_Real filter_x_scale, filter_y_scale;
+    Resample_Real src_x_ofs, src_y_ofs;
+    Resample_Real max_tap_error;
+    Contrib_List* Pclist_x;
+    Contrib_List* Pclist_y;
+    unsigned int num_threads;
+
+#ifdef RESAMPLER_THREADS
+    std::thread thread;
+    std::atomic< bool > done;
+#endif
+};
+
+// false while the contributor lists are built in the background, unless wait is true. Once they're
+// done, the source lines put_line() queued in the meantime are supplied.
+bool Resampler::clists_ready( bool wait )
+{
+    if( !m_Pbuilder )
+        return true;
+
+#ifdef RESAMPLER_THREADS
+    if( !wait && !m_Pbuilder->done )
+        return false;
+#else
+    ( void ) wait;
+#endif
+
+    join_clists();
+    delete m_Pbuilder;
+    m_Pbuilder = NULL;
+
+    std::vector< std::vector< Sample > > pending;
+    pending.swap( m_pending_lines );
+    if( m_status == STATUS_OKAY )
+    {
+        // A line that can't be taken fails the resampler, the caller's put_line() already returned true.
+        for( unsigned int i = 0; i < pending.size(); i++ )
+        {
+            if( !put_line( &pending[ i ][ 0 ] ) )
+            {
+                if( m_status == STATUS_OKAY )
+                    m_status = STATUS_OUT_OF_MEMORY;
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Waits for the background thread building the contributor lists, if any.
+void Resampler::join_clists() const
+{
+#ifdef RESAMPLER_THREADS
+    if( m_Pbuilder && m_Pbuilder->thread.joinable() )
+        m_Pbuilder->thread.join();
+#endif
+}
+
+Resampler::Resampler
+    (
+    unsigned int src_w, unsigned int src_h,
+    unsigned int dst_w, unsigned int dst_h,
+    Boundary_Op boundary_op,
+    Resample_Real sample_low,
+    Resample_Real sample_high,
+    const char* Pfilter_name,
+    Contrib_List* Pclist_x,
+    Contrib_List* Pclist_y,
+    Resample_Real filter_x_scale,
+    Resample_Real filter_y_scale,
+    Resample_Real src_x_ofs,
+    Resample_Real src_y_ofs,
+    unsigned int dst_subrect_x, unsigned int dst_subrect_y,
+    unsigned int dst_subrect_w, unsigned int dst_subrect_h,
+    Resample_Real max_tap_error,
+    bool continuous_y,
+    size_t max_scan_buf_size,
+    unsigned int clist_threads,
+    bool skip_constant_regions
     )
 {
     m_lo = sample_low;
     m_hi = sample_high;
 
     m_delay_x_resample = false;
+    m_identity_x = false;
+    m_identity_y = false;
+    m_pass_ready = false;
+    m_scatter_y = false;
     m_intermediate_x = 0;
+    m_src_x_beg = 0;
+    m_continuous_y = continuous_y;
+    m_src_y_end = src_h;
+    m_cont_period = 0;
+    m_cont_row0 = 0;
+    m_Pclist_y_period = NULL;
     m_Pclist_x = NULL;
     m_Pclist_y = NULL;
     m_status = STATUS_OKAY;
+    m_stats.pruned_taps_x = 0;
+    m_stats.pruned_taps_y = 0;
+    m_stats.spilled_lines = 0;
+    m_stats.const_samples = 0;
+    m_stats.filtered_samples = 0;
+    m_skip_constant = skip_constant_regions;
+    m_max_scan_buf_size = max_scan_buf_size;
+    m_Pspill_file = NULL;
+    m_num_spill_slots = 0;
+    m_Pbuilder = NULL;
+
+    m_resample_src_w = src_w;
+    m_resample_src_h = src_h;
+    m_resample_dst_w = dst_w;
+    m_resample_dst_h = dst_h;
+
+    // assume we're outputting everything by default...
+    m_dst_subrect_beg_x = 0;
+    m_dst_subrect_end_x = dst_w;
+    m_dst_subrect_beg_y = 0;
+    m_dst_subrect_end_y = dst_h;
+
+    // ...or maybe we have a valid dst subrect
+    if( dst_subrect_w > 0 && dst_subrect_h > 0 &&
+        dst_subrect_x + dst_subrect_w <= dst_w &&
+        dst_subrect_y + dst_subrect_h <= dst_h )
+    {
+        m_dst_subrect_beg_x = dst_subrect_x;
+        m_dst_subrect_end_x = dst_subrect_x + dst_subrect_w;
+        m_dst_subrect_beg_y = dst_subrect_y;
+        m_dst_subrect_end_y = dst_subrect_y + dst_subrect_h;
+    }
+
+    // A continuous stream is resampled a period at a time.
+    if( m_continuous_y )
+    {
+        m_dst_subrect_beg_y = 0;
+        m_dst_subrect_end_y = dst_h;
+    }
+
+    m_boundary_op = boundary_op;
+
+    m_Pdst_buf.resize( m_dst_subrect_end_x - m_dst_subrect_beg_x );
+
+    // Find the specified filter.
+    if( Pfilter_name == NULL )
+        Pfilter_name = RESAMPLER_DEFAULT_FILTER;
+
+    Filter filter;
+    if( !find_filter( Pfilter_name, filter ) )
+    {
+        m_status = STATUS_BAD_FILTER_NAME;
+        return;
+    }
+
+    // Create contributor lists, unless the user supplied custom lists.
+    std::auto_ptr< Clist_Builder > Pbuilder( new Clist_Builder );
+    Pbuilder->filter = filter;
+    Pbuilder->filter_x_scale = filter_x_scale;
+    Pbuilder->filter_y_scale = filter_y_scale;
+    Pbuilder->src_x_ofs = src_x_ofs;
+    Pbuilder->src_y_ofs = src_y_ofs;
+    Pbuilder->max_tap_error = max_tap_error;
+    Pbuilder->Pclist_x = Pclist_x;
+    // Continuous mode lists are numbered relative to their first source line, so they can't be shared.
+    Pbuilder->Pclist_y = m_continuous_y ? NULL : Pclist_y;
+    Pbuilder->num_threads = clist_threads;
+
+#ifdef RESAMPLER_THREADS
+    if( clist_threads > 0 )
+    {
+        // Build them in the background, see clists_ready().
+        m_Pbuilder = Pbuilder.release();
+        m_Pbuilder->done = false;
+        m_Pbuilder->thread = std::thread( clist_thread, this );
+        return;
+    }
+#endif
+
+    build_clists( *Pbuilder );
+}
+
+// Runs build_clists() on a background thread.
+void Resampler::clist_thread( Resampler* Presampler )
+{
+#ifdef RESAMPLER_THREADS
+    Presampler->build_clists( *Presampler->m_Pbuilder );
+    Presampler->m_Pbuilder->done = true;
+#else
+    ( void ) Presampler;
+#endif
+}
+
+// Builds the contributor lists the builder asks for, then sets up everything which depends on them.
+// With several threads, the X and Y axes are built in parallel.
+void Resampler::build_clists( const Clist_Builder& builder )
+{
+    const bool make_x = ( builder.Pclist_x == NULL );
+    const bool make_y = ( builder.Pclist_y == NULL );
+
+    unsigned int threads_y = builder.num_threads;
+    unsigned int threads_x = builder.num_threads;
+    if( make_x && make_y )
+    {
+        threads_y = builder.num_threads / 2;
+        threads_x = builder.num_threads - threads_y;
+    }
+
+    bool ok_x = true, ok_y = true;
+
+#ifdef RESAMPLER_THREADS
+    if( make_x && make_y && ( threads_y > 0 ) )
+    {
+        std::thread y_thread( build_clist_y, this, std::cref( builder ), threads_y, &ok_y );
+        build_clist_x( this, builder, threads_x, &ok_x );
+        y_thread.join();
+    }
+    else
+#endif
+    {
+        build_clist_x( this, builder, threads_x, &ok_x );
+        build_clist_y( this, builder, threads_y, &ok_y );
+    }
+
+    if( !ok_x || !ok_y )
+    {
+        m_status = STATUS_OUT_OF_MEMORY;
+        return;
+    }
+
+    init_resample();
+}
+
+void Resampler::build_clist_x( Resampler* Presampler, const Clist_Builder& builder, unsigned int num_threads, bool* Pok )
+{
+    Resampler& r = *Presampler;
+
+    if( builder.Pclist_x )
+    {
+        r.m_Pclist_x = builder.Pclist_x;
+        return;
+    }
+
+    r.m_Pclistc_x = make_cached_clist( r.m_resample_src_w, r.m_resample_dst_w, r.m_dst_subrect_beg_x, r.m_dst_subrect_end_x, r.m_boundary_op,
+                                builder.filter, builder.filter_x_scale, builder.src_x_ofs, builder.max_tap_error, false, num_threads );
+    if( NULL == r.m_Pclistc_x.get() )
+    {
+        *Pok = false;
+        return;
+    }
+    r.m_Pclist_x = &r.m_Pclistc_x->clists[ 0 ];
+    r.m_stats.pruned_taps_x = r.m_Pclistc_x->num_pruned;
+}
+
+void Resampler::build_clist_y( Resampler* Presampler, const Clist_Builder& builder, unsigned int num_threads, bool* Pok )
+{
+    Resampler& r = *Presampler;
+
+    if( builder.Pclist_y )
+    {
+        r.m_Pclist_y = builder.Pclist_y;
+        return;
+    }
+
+    r.m_Pclistc_y = make_cached_clist( r.m_resample_src_h, r.m_resample_dst_h, r.m_dst_subrect_beg_y, r.m_dst_subrect_end_y, r.m_boundary_op,
+                                builder.filter, builder.filter_y_scale, builder.src_y_ofs, builder.max_tap_error, r.m_continuous_y, num_threads );
+    if( NULL == r.m_Pclistc_y.get() )
+    {
+        *Pok = false;
+        return;
+    }
+    r.m_Pclist_y = &r.m_Pclistc_y->clists[ 0 ];
+    r.m_stats.pruned_taps_y = r.m_Pclistc_y->num_pruned;
+}
+
+// Sets up everything which depends on the contributor lists.
+void Resampler::init_resample()
+{
+    const unsigned int subrect_w = m_dst_subrect_end_x - m_dst_subrect_beg_x;
+    const unsigned int subrect_h = m_dst_subrect_end_y - m_dst_subrect_beg_y;
+
+    if( m_continuous_y )
+        init_continuous_y();
+    else
+    {
+        m_Psrc_y_count.resize( m_resample_src_h, 0 );
+
+        m_Psrc_y_flag.resize( m_resample_src_h );
+
+        // Count how many times each source line contributes to a destination line of the subrect.
+        // Source lines which don't contribute to any of them are skipped by put_line().
+        for( unsigned int i = 0; i < subrect_h; i++ )
+            for( unsigned int j = 0; j < m_Pclist_y[ i ].n; j++ )
+                m_Psrc_y_count[ m_Pclist_y[ i ].p[ j ].pixel ]++;
+    }
+
+    // The source columns the subrect's X contributors read.
+    unsigned int src_x_beg = m_resample_src_w, src_x_end = 0;
+    for( unsigned int i = 0; i < subrect_w; i++ )
+    {
+        for( unsigned int j = 0; j < m_Pclist_x[ i ].n; j++ )
+        {
+            const unsigned int pixel = m_Pclist_x[ i ].p[ j ].pixel;
+            if( pixel < src_x_beg )
+                src_x_beg = pixel;
+            if( pixel + 1 > src_x_end )
+                src_x_end = pixel + 1;
+        }
+    }
+    const unsigned int src_span_w = src_x_end - src_x_beg;
+
+    m_cur_src_y = m_cont_row0;
+    m_cur_dst_y = m_dst_subrect_beg_y;
+    {
+        // Determine which axis to resample first by comparing the number of multiplies required
+        // for each possibility.
+        // Only the subrect is generated, so only its contributors count. The products can
+        // overflow 32 bits for large images.
+        double x_ops = count_ops( m_Pclist_x, subrect_w );
+        double y_ops = count_ops( m_Pclist_y, subrect_h );
+
+        // Hack 10/2000: Weight Y axis ops a little more than X axis ops.
+        // (Y axis ops use more cache resources.)
+        double xy_ops = x_ops * m_resample_src_h +
+                        ( 4 * y_ops * subrect_w ) / 3;
+
+        // Y-X order only buffers and sums the source columns the subrect reads.
+        double yx_ops = ( 4 * y_ops * src_span_w ) / 3 +
+                        x_ops * subrect_h;
+
+        // An identity axis is just a copy (see is_identity()), which X-Y order does best:
+        // it only buffers the subrect's columns, and hands the lines straight to get_line().
+        m_identity_x = ( m_resample_src_w == m_resample_dst_w ) && is_identity( m_Pclist_x, m_dst_subrect_beg_x, m_dst_subrect_end_x );
+        m_identity_y = !m_continuous_y && ( m_resample_src_h == m_resample_dst_h ) && is_identity( m_Pclist_y, m_dst_subrect_beg_y, m_dst_subrect_end_y );
+
+        // Now check which resample order is better. In case of a tie, choose the order
+        // which buffers the least amount of data.
+        if( ( !m_identity_x && !m_identity_y ) &&
+            ( ( xy_ops > yx_ops ) ||
+              ( ( xy_ops == yx_ops ) && ( src_span_w < subrect_w ) ) )
+            )
+        {
+            m_delay_x_resample = true;
+            crop_src_x( src_x_beg, src_x_end );
+        }
+        else
+        {
+            m_delay_x_resample = false;
+            m_intermediate_x = subrect_w;
+        }
+    }
+
+    if( m_delay_x_resample )
+    {
+        m_Ptmp_buf.resize( m_intermediate_x );
+    }
+
+    if( m_skip_constant )
+    {
+        // In Y-X order, relative to the cropped lines.
+        m_clist_x_lo.resize( subrect_w );
+        m_clist_x_hi.resize( subrect_w );
+        for( unsigned int i = 0; i < subrect_w; i++ )
+        {
+            unsigned int lo = 1, hi = 0;
+            for( unsigned int j = 0; j < m_Pclist_x[ i ].n; j++ )
+            {
+                const unsigned int pixel = m_Pclist_x[ i ].p[ j ].pixel;
+                if( !j || ( pixel < lo ) )
+                    lo = pixel;
+                if( !j || ( pixel > hi ) )
+                    hi = pixel;
+            }
+            m_clist_x_lo[ i ] = lo;
+            m_clist_x_hi[ i ] = hi;
+        }
+    }
+
+    init_scatter_y();
+
+    init_strips();
+
+    init_x_tiles();
+
+    init_upsample_x();
+}
+
+// Chooses between the two Y axis engines by simulating how many lines each one buffers at most.
+// Gathering (the default) keeps each source line until the last destination line it contributes
+// to is generated. Scattering (see scatter_y()) adds each source line into the destination lines it
+// contributes to right away, and keeps those partial sums until their last contributor arrives.
+// When downsampling a lot, each destination line has many contributors, so there are far fewer
+// partial sums than source lines to keep. A scattered add also has to write the partial sum back,
+// so scattering is only chosen if it at least halves the number of buffered lines.
+void Resampler::init_scatter_y()
+{
+    m_scatter_y = false;
+
+    // Skipping constant regions needs the gathered lines.
+    if( m_continuous_y || m_identity_y || m_skip_constant )
+        return;
+
+    const unsigned int src_h = m_resample_src_h;
+    const unsigned int dst_h = m_dst_subrect_end_y - m_dst_subrect_beg_y;
+
+    // Live line count changes, at each source line.
+    std::vector< int > gather_live( src_h + 1, 0 );
+    std::vector< int > scatter_live( src_h + 1, 0 );
+    std::vector< unsigned int > release( src_h, 0 );
+
+    // Destination lines are generated in order, once all their contributors arrived.
+    unsigned int done = 0;
+    for( unsigned int i = 0; i < dst_h; i++ )
+    {
+        const Contrib_List& clist = m_Pclist_y[ i ];
+        unsigned int lo = src_h, hi = 0;
+        for( unsigned int j = 0; j < clist.n; j++ )
+        {
+            if( clist.p[ j ].pixel < lo )
+                lo = clist.p[ j ].pixel;
+            if( clist.p[ j ].pixel > hi )
+                hi = clist.p[ j ].pixel;
+        }
+
+        if( hi > done )
+            done = hi;
+        for( unsigned int j = 0; j < clist.n; j++ )
+            if( release[ clist.p[ j ].pixel ] < done )
+                release[ clist.p[ j ].pixel ] = done;
+
+        scatter_live[ lo ]++;
+        scatter_live[ hi + 1 ]--;
+    }
+
+    for( unsigned int y = 0; y < src_h; y++ )
+    {
+        if( m_Psrc_y_count[ y ] )
+        {
+            gather_live[ y ]++;
+            gather_live[ ( release[ y ] > y ? release[ y ] : y ) + 1 ]--;
+        }
+    }
+
+    int gather = 0, scatter = 0, gather_peak = 0, scatter_peak = 0;
+    for( unsigned int y = 0; y < src_h; y++ )
+    {
+        gather += gather_live[ y ];
+        scatter += scatter_live[ y ];
+        if( gather > gather_peak )
+            gather_peak = gather;
+        if( scatter > scatter_peak )
+            scatter_peak = scatter;
+    }
+
+    if( 2 * scatter_peak > gather_peak )
+        return;
+
+    // The partial sums can't be spilled, so with a scan buffer cap they must fit under it.
+    if( ( m_max_scan_buf_size > 0 ) && ( ( double ) scatter_peak * m_intermediate_x * sizeof( Sample ) > ( double ) m_max_scan_buf_size ) )
+        return;
+
+    m_scatter_y = true;
+
+    // Invert the contributor lists: for each source line, the destination lines it contributes to.
+    // The partial sums add their contributors as the source lines arrive, in ascending order, while
+    // gathering adds them in list order. At reflected or clamped edges the lists aren't ascending,
+    // so there the results only match gathering up to the order of the summation.
+    m_scatter_beg.assign( src_h + 1, 0 );
+    for( unsigned int i = 0; i < dst_h; i++ )
+        for( unsigned int j = 0; j < m_Pclist_y[ i ].n; j++ )
+            m_scatter_beg[ m_Pclist_y[ i ].p[ j ].pixel + 1 ]++;
+    for( unsigned int y = 0; y < src_h; y++ )
+        m_scatter_beg[ y + 1 ] += m_scatter_beg[ y ];
+
+    std::vector< unsigned int > next( m_scatter_beg.begin(), m_scatter_beg.end() - 1 );
+    m_scatter.resize( m_scatter_beg[ src_h ] );
+    m_dst_y_count.resize( dst_h );
+    for( unsigned int i = 0; i < dst_h; i++ )
+    {
+        m_dst_y_count[ i ] = m_Pclist_y[ i ].n;
+        for( unsigned int j = 0; j < m_Pclist_y[ i ].n; j++ )
+        {
+            Scatter_Contrib& c = m_scatter[ next[ m_Pclist_y[ i ].p[ j ].pixel ]++ ];
+            c.dst_y = m_dst_subrect_beg_y + i;
+            c.weight = m_Pclist_y[ i ].p[ j ].weight;
+        }
+    }
+}
+
+// Adds source line m_cur_src_y into the partial sums of the destination lines it contributes to.
+void Resampler::scatter_y( const Sample* Psrc )
+{
+    const Sample* Pline;
+    if( m_delay_x_resample )
+        Pline = Psrc + m_src_x_beg;
+    else
+    {
+        m_Ptmp_buf.resize( m_intermediate_x );
+        resample_x( &m_Ptmp_buf[ 0 ], Psrc, 0, m_intermediate_x );
+        Pline = &m_Ptmp_buf[ 0 ];
+    }
+
+    for( unsigned int i = m_scatter_beg[ m_cur_src_y ]; i < m_scatter_beg[ m_cur_src_y + 1 ]; i++ )
+    {
+        const Scatter_Contrib& c = m_scatter[ i ];
+        std::vector< Sample >& accum = m_Paccum_buf[ c.dst_y ];
+        if( accum.empty() )
+        {
+            accum.resize( m_intermediate_x );
+            scale_y_mov( &accum[ 0 ], Pline, c.weight, m_intermediate_x );
+        }
+        else
+            scale_y_add( &accum[ 0 ], Pline, c.weight, m_intermediate_x );
+
+        m_dst_y_count[ c.dst_y - m_dst_subrect_beg_y ]--;
+    }
+
+    m_Psrc_y_count[ m_cur_src_y ] = 0;
+}
+
+// In Y-X order, only source columns [src_x_beg, src_x_end) are stored by put_line(), so the
+// intermediate lines start at column src_x_beg. The X contributor lists are copied with their
+// source indices rebased, the original lists may be shared with (or by) another Resampler.
+void Resampler::crop_src_x( unsigned int src_x_beg, unsigned int src_x_end )
+{
+    m_src_x_beg = src_x_beg;
+    m_intermediate_x = src_x_end - src_x_beg;
+
+    if( !src_x_beg )
+        return;
+
+    const unsigned int dst_w = m_dst_subrect_end_x - m_dst_subrect_beg_x;
+
+    m_Pclistc_x_crop.reset( new Contrib_List_Container );
+    m_Pclistc_x_crop->cpool.resize( count_ops( m_Pclist_x, dst_w ) );
+    m_Pclistc_x_crop->clists.resize( dst_w );
+    m_Pclistc_x_crop->num_pruned = 0;
+    m_Pclistc_x_crop->pixel_ofs = 0;
+
+    Contrib* Pcontrib = &m_Pclistc_x_crop->cpool[ 0 ];
+    for( unsigned int i = 0; i < dst_w; i++ )
+    {
+        const Contrib_List& src_clist = m_Pclist_x[ i ];
+        Contrib_List& clist = m_Pclistc_x_crop->clists[ i ];
+
+        clist.n = src_clist.n;
+        clist.p = Pcontrib;
+        for( unsigned int j = 0; j < clist.n; j++ )
+        {
+            clist.p[ j ].weight = src_clist.p[ j ].weight;
+            clist.p[ j ].pixel = src_clist.p[ j ].pixel - src_x_beg;
+        }
+        Pcontrib += clist.n;
+    }
+
+    m_Pclist_x = &m_Pclistc_x_crop->clists[ 0 ];
+}
+
+Resampler::~Resampler()
+{
+    join_clists();
+    delete m_Pbuilder;
+
+    if( m_Pspill_file )
+        fclose( m_Pspill_file );
+}
+
+// In continuous_y mode the Y axis contributor lists repeat every dst_h destination lines,
+// shifted by src_h source lines. Only one period of lists is kept, and the source lines are
+// numbered relative to the current period: line y of the period is pixel y + m_cont_row0 of
+// the lists. Once a period is done, next_period() renumbers the buffered lines, so the
+// bookkeeping only covers about a filter window of lines.
+void Resampler::init_continuous_y()
+{
+    const unsigned int src_h = m_resample_src_h;
+    const unsigned int dst_h = m_resample_dst_h;
+
+    m_Pclist_y_period = m_Pclist_y;
+    m_cont_row0 = -m_Pclistc_y->pixel_ofs;
+    m_cont_period = 0;
+
+    // The lines a period can buffer: all of its contributors, the lines reflected at the top,
+    // and at least a period's worth, so the next period can start.
+    unsigned int end = src_h;
+    for( unsigned int i = 0; i < dst_h; i++ )
+        for( unsigned int j = 0; j < m_Pclist_y[ i ].n; j++ )
+            if( m_Pclist_y[ i ].p[ j ].pixel + 1 > end )
+                end = m_Pclist_y[ i ].p[ j ].pixel + 1;
+    if( ( m_boundary_op == BOUNDARY_REFLECT ) && ( 2 * m_cont_row0 + 1 > end ) )
+        end = 2 * m_cont_row0 + 1;
+    m_src_y_end = end;
+
+    // How many times each line is used by the lists of a period. The first periods have
+    // contributors above the first line of the stream, which move to other lines.
+    m_cont_uses.assign( end, 0 );
+    m_cont_top_uses.resize( ( m_cont_row0 + src_h - 1 ) / src_h );
+    for( unsigned int q = 0; q < m_cont_top_uses.size(); q++ )
+        m_cont_top_uses[ q ].assign( end, 0 );
+
+    for( unsigned int i = 0; i < dst_h; i++ )
+    {
+        for( unsigned int j = 0; j < m_Pclist_y[ i ].n; j++ )
+        {
+            const unsigned int pixel = m_Pclist_y[ i ].p[ j ].pixel;
+            m_cont_uses[ pixel ]++;
+            for( unsigned int q = 0; q < m_cont_top_uses.size(); q++ )
+                m_cont_top_uses[ q ][ resolve_y( pixel, q ) ]++;
+        }
+    }
+
+    m_Psrc_y_count.resize( end );
+    m_Psrc_y_flag.resize( end );
+    for( unsigned int i = 0; i < end; i++ )
+        m_Psrc_y_count[ i ] = cont_count( i );
+
+    set_period_clist_y();
+}
+
+// The line of period number period which pixel of the periodic lists refers to, applying the
+// boundary op to the lines above the first line of the stream. There's no last line, so
+// BOUNDARY_WRAP clamps.
+unsigned int Resampler::resolve_y( unsigned int pixel, unsigned int period ) const
+{
+    const unsigned int period_beg = period * m_resample_src_h;
+    if( pixel + period_beg >= m_cont_row0 )
+        return pixel;
+
+    const unsigned int line = ( m_boundary_op == BOUNDARY_REFLECT ) ? ( m_cont_row0 - pixel - period_beg ) : 0;
+    return line + m_cont_row0 - period_beg;
+}
+
+// How many times line src_y of the current period is used, by this period and the next ones.
+// Lines used by an earlier period were buffered back then, so they don't need counting.
+unsigned int Resampler::cont_count( unsigned int src_y ) const
+{
+    unsigned int count = 0;
+    for( unsigned int k = 0; k * m_resample_src_h <= src_y; k++ )
+    {
+        const unsigned int period = m_cont_period + k;
+        const unsigned int y = src_y - k * m_resample_src_h;
+        count += ( period < m_cont_top_uses.size() ) ? m_cont_top_uses[ period ][ y ] : m_cont_uses[ y ];
+    }
+    return count;
+}
+
+// Points m_Pclist_y at the lists of the current period.
+void Resampler::set_period_clist_y()
+{
+    if( m_cont_period >= m_cont_top_uses.size() )
+    {
+        m_Pclist_y = m_Pclist_y_period;
+        return;
+    }
+
+    const unsigned int dst_h = m_resample_dst_h;
+
+    if( !m_Pclistc_y_top.get() )
+    {
+        m_Pclistc_y_top.reset( new Contrib_List_Container );
+        m_Pclistc_y_top->cpool.resize( count_ops( m_Pclist_y_period, dst_h ) );
+        m_Pclistc_y_top->clists.resize( dst_h );
+        m_Pclistc_y_top->num_pruned = 0;
+        m_Pclistc_y_top->pixel_ofs = 0;
+    }
+
+    Contrib* Pcontrib = &m_Pclistc_y_top->cpool[ 0 ];
+    for( unsigned int i = 0; i < dst_h; i++ )
+    {
+        const Contrib_List& src_clist = m_Pclist_y_period[ i ];
+        Contrib_List& clist = m_Pclistc_y_top->clists[ i ];
+
+        clist.n = src_clist.n;
+        clist.p = Pcontrib;
+        for( unsigned int j = 0; j < clist.n; j++ )
+        {
+            clist.p[ j ].weight = src_clist.p[ j ].weight;
+            clist.p[ j ].pixel = resolve_y( src_clist.p[ j ].pixel, m_cont_period );
+        }
+        Pcontrib += clist.n;
+    }
+
+    m_Pclist_y = &m_Pclistc_y_top->clists[ 0 ];
+}
+
+// In continuous_y mode, moves on to the next period once all the destination lines of the
+// current one were generated, and all of its source lines supplied.
+void Resampler::next_period()
+{
+    if( !m_continuous_y || ( m_cur_dst_y < m_dst_subrect_end_y ) || ( m_cur_src_y < m_resample_src_h ) )
+        return;
+
+    const unsigned int src_h = m_resample_src_h;
+    const unsigned int end = m_src_y_end;
+
+    // Renumber the buffered lines, the first src_h lines aren't used anymore.
+    std::map< int, std::vector< Sample > > scan_buf;
+    for( std::map< int, std::vector< Sample > >::iterator it = m_Pscan_buf.begin(); it != m_Pscan_buf.end(); ++it )
+    {
+        assert( it->first >= ( int ) src_h );
+        scan_buf[ it->first - src_h ].swap( it->second );
+    }
+    m_Pscan_buf.swap( scan_buf );
+
+    std::map< int, std::vector< Const_Span > > const_spans;
+    for( std::map< int, std::vector< Const_Span > >::iterator it = m_const_spans.begin(); it != m_const_spans.end(); ++it )
+        const_spans[ it->first - src_h ].swap( it->second );
+    m_const_spans.swap( const_spans );
+
+    std::map< int, unsigned int > spill_slots;
+    for( std::map< int, unsigned int >::iterator it = m_spill_slots.begin(); it != m_spill_slots.end(); ++it )
+    {
+        assert( it->first >= ( int ) src_h );
+        spill_slots[ it->first - src_h ] = it->second;
+    }
+    m_spill_slots.swap( spill_slots );
 
-    m_resample_src_w = src_w;
-    m_resample_src_h = src_h;
-    m_resample_dst_w = dst_w;
-    m_resample_dst_h = dst_h;
+    for( unsigned int i = src_h; i < end; i++ )
+    {
+        m_Psrc_y_count[ i - src_h ] = m_Psrc_y_count[ i ];
+        m_Psrc_y_flag[ i - src_h ] = m_Psrc_y_flag[ i ];
+    }
 
-    // assume we're outputting everything by default...
-    m_dst_subrect_beg_x = 0;
-    m_dst_subrect_end_x = dst_w;
-    m_dst_subrect_beg_y = 0;
-    m_dst_subrect_end_y = dst_h;
+    m_cur_src_y -= src_h;
+    m_cur_dst_y = m_dst_subrect_beg_y;
+    if( m_cont_period < m_cont_top_uses.size() )
+        m_cont_period++;
 
-    // ...or maybe we have a valid dst subrect
-    if( dst_subrect_w > 0 && dst_subrect_h > 0 &&
-        dst_subrect_x + dst_subrect_w <= dst_w &&
-        dst_subrect_y + dst_subrect_h <= dst_h )
+    for( unsigned int i = end - src_h; i < end; i++ )
     {
-        m_dst_subrect_beg_x = dst_subrect_x;
-        m_dst_subrect_end_x = dst_subrect_x + dst_subrect_w;
-        m_dst_subrect_beg_y = dst_subrect_y;
-        m_dst_subrect_end_y = dst_subrect_y + dst_subrect_h;
+        m_Psrc_y_count[ i ] = cont_count( i );
+        m_Psrc_y_flag[ i ] = false;
     }
 
-    m_boundary_op = boundary_op;
+    set_period_clist_y();
+}
 
-    m_Pdst_buf.resize( m_dst_subrect_end_x - m_dst_subrect_beg_x );
+// When upsampling on the X axis, each source sample contributes to several neighbouring
+// destination samples. Find the longest run of destination samples whose contributors are
+// consecutive source samples (everything but the edges), and store their first contributor
+// and weights padded to a fixed number of taps, so resample_x_upsample() can slide a
+// window along the source line instead of gathering each contributor. Zero weights are
+// added in place of the missing contributors, so the results don't change.
+void Resampler::init_upsample_x()
+{
+    m_upsample_taps = 0;
+    m_upsample_beg = m_upsample_end = 0;
+    m_upsample_base.clear();
+    m_upsample_weights.clear();
 
-    // Find the specified filter.
-    if( Pfilter_name == NULL )
-        Pfilter_name = RESAMPLER_DEFAULT_FILTER;
+    if( m_resample_dst_w <= m_resample_src_w )
+        return;
 
-    Resample_Real support, ( *func )( Resample_Real );
+    const unsigned int dst_w = m_dst_subrect_end_x - m_dst_subrect_beg_x;
+    const Contrib_List* Pclist = m_Pclist_x;
+    const unsigned int src_w = m_delay_x_resample ? m_intermediate_x : m_resample_src_w;
+
+    unsigned int best_beg = 0, best_end = 0, best_taps = 0;
+    unsigned int run_beg = 0, run_taps = 0, prev_base = 0;
+
+    for( unsigned int i = 0; i <= dst_w; i++ )
     {
-        unsigned int i;
-        for( i = 0; i < NUM_FILTERS; i++ )
+        bool regular = ( i < dst_w ) && ( Pclist[ i ].n > 0 );
+        unsigned int taps = 0;
+
+        if( regular )
         {
-            if( strcmp( Pfilter_name, g_filters[ i ].name ) == 0 )
-                break;
+            const Contrib* p = Pclist[ i ].p;
+            for( unsigned int j = 1; j < Pclist[ i ].n; j++ )
+                if( p[ j ].pixel <= p[ j - 1 ].pixel )
+                    regular = false;
+
+            taps = p[ Pclist[ i ].n - 1 ].pixel - p[ 0 ].pixel + 1;
+            if( ( i > run_beg ) && ( p[ 0 ].pixel < prev_base ) )
+                regular = false;
+            if( taps > MAX_UPSAMPLE_TAPS )
+                regular = false;
         }
 
-        if( i == NUM_FILTERS )
+        if( regular )
         {
-            m_status = STATUS_BAD_FILTER_NAME;
-            return;
+            if( taps < run_taps )
+                taps = run_taps;
+
+            // The window must stay inside the source line.
+            if( Pclist[ i ].p[ 0 ].pixel + taps > src_w )
+                regular = false;
+            else
+                run_taps = taps;
+        }
+
+        if( !regular )
+        {
+            if( i - run_beg > best_end - best_beg )
+            {
+                best_beg = run_beg;
+                best_end = i;
+                best_taps = run_taps;
+            }
+
+            run_beg = i + 1;
+            run_taps = 0;
+            continue;
         }
 
-        func = g_filters[ i ].func;
-        support = g_filters[ i ].support;
+        prev_base = Pclist[ i ].p[ 0 ].pixel;
     }
 
-    // Create contributor lists, unless the user supplied custom lists.
+    if( best_end - best_beg < MIN_UPSAMPLE_RUN )
+        return;
 
-    if( !Pclist_x )
+    m_upsample_taps = best_taps;
+    m_upsample_beg = best_beg;
+    m_upsample_end = best_end;
+    m_upsample_base.resize( best_end - best_beg );
+    m_upsample_weights.resize( ( best_end - best_beg ) * best_taps, 0.0f );
+
+    for( unsigned int i = best_beg; i < best_end; i++ )
+    {
+        const Contrib* p = Pclist[ i ].p;
+        const unsigned int base = p[ 0 ].pixel;
+
+        m_upsample_base[ i - best_beg ] = base;
+        for( unsigned int j = 0; j < Pclist[ i ].n; j++ )
+            m_upsample_weights[ ( i - best_beg ) * best_taps + ( p[ j ].pixel - base ) ] = p[ j ].weight;
+    }
+}
+
+// Returns the size in bytes of the level 1 data cache or the level 2 cache,
+// or a conservative guess if the platform can't tell.
+static unsigned int get_cache_size( int level )
+{
+    long bytes = 0;
+#if defined( _SC_LEVEL1_DCACHE_SIZE ) && defined( _SC_LEVEL2_CACHE_SIZE )
+    bytes = sysconf( ( level == 1 ) ? _SC_LEVEL1_DCACHE_SIZE : _SC_LEVEL2_CACHE_SIZE );
+#elif defined( _WIN32 )
+    DWORD len = 0;
+    GetLogicalProcessorInformation( NULL, &len );
+    std::vector< SYSTEM_LOGICAL_PROCESSOR_INFORMATION > info( len / sizeof( SYSTEM_LOGICAL_PROCESSOR_INFORMATION ) + 1 );
+    if( GetLogicalProcessorInformation( &info[ 0 ], &len ) )
     {
-        m_Pclistc_x = make_clist( m_resample_src_w, m_resample_dst_w, m_boundary_op, func, support, filter_x_scale, src_x_ofs );
-        if( NULL == m_Pclistc_x.get() )
+        for( unsigned int i = 0; i < len / sizeof( SYSTEM_LOGICAL_PROCESSOR_INFORMATION ); i++ )
         {
-            m_status = STATUS_OUT_OF_MEMORY;
-            return;
+            if( ( info[ i ].Relationship == RelationCache ) && ( info[ i ].Cache.Level == level ) &&
+                ( info[ i ].Cache.Type != CacheInstruction ) )
+                bytes = info[ i ].Cache.Size;
         }
-        m_Pclist_x = &m_Pclistc_x->clists[ 0 ];
     }
-    else
+#endif
+
+    if( bytes <= 0 )
+        bytes = ( level == 1 ) ? 32 * 1024 : 256 * 1024;
+
+    return ( unsigned int ) bytes;
+}
+
+// Looked up once at startup, like g_Psimd, so resamplers built on several threads only read them.
+static const unsigned int g_l1_size = get_cache_size( 1 );
+static const unsigned int g_l2_size = get_cache_size( 2 );
+
+// Splits the intermediate lines into strips when a line and all of its Y axis contributors
+// don't fit in the level 2 cache. The strip width keeps a strip of partial sums in the level 1
+// cache, and all the strips of contributors in the level 2 cache.
+void Resampler::init_strips()
+{
+    m_strip_w = m_intermediate_x;
+    m_strips.clear();
+
+    unsigned int max_n = 0;
+    for( unsigned int i = m_dst_subrect_beg_y; i < m_dst_subrect_end_y; i++ )
+        if( clist_y( i ).n > max_n )
+            max_n = clist_y( i ).n;
+
+    const unsigned int l1_size = g_l1_size;
+    const unsigned int l2_size = g_l2_size;
+
+    if( ( double ) m_intermediate_x * sizeof( Sample ) * ( max_n + 1 ) <= l2_size )
+        return;
+
+    unsigned int strip_w = l1_size / ( 2 * sizeof( Sample ) );
+    if( strip_w > l2_size / ( 2 * sizeof( Sample ) * ( max_n + 1 ) ) )
+        strip_w = l2_size / ( 2 * sizeof( Sample ) * ( max_n + 1 ) );
+    strip_w = ( strip_w < ( unsigned int ) MIN_STRIP_W ) ? ( unsigned int ) MIN_STRIP_W : ( strip_w & ~15U );
+
+    if( strip_w >= m_intermediate_x )
+        return;
+
+    m_strip_w = strip_w;
+
+    if( !m_delay_x_resample )
+        return;
+
+    // In Y-X order, find the range of intermediate samples each strip of destination samples
+    // reads. Give up on destination strips if the ranges overlap too much (wrapping).
+    const unsigned int dst_w = m_dst_subrect_end_x - m_dst_subrect_beg_x;
+    unsigned int total = 0;
+    for( unsigned int dst_beg = 0; dst_beg < dst_w; dst_beg += strip_w )
     {
-        m_Pclist_x = Pclist_x;
+        Strip strip;
+        strip.dst_beg = dst_beg;
+        strip.dst_end = ( ( dst_w - dst_beg ) < strip_w ) ? dst_w : ( dst_beg + strip_w );
+        strip.src_beg = m_intermediate_x;
+        strip.src_end = 0;
+
+        for( unsigned int i = strip.dst_beg; i < strip.dst_end; i++ )
+        {
+            const Contrib_List& clist = m_Pclist_x[ i ];
+            for( unsigned int j = 0; j < clist.n; j++ )
+            {
+                if( clist.p[ j ].pixel < strip.src_beg )
+                    strip.src_beg = clist.p[ j ].pixel;
+                if( clist.p[ j ].pixel + 1U > strip.src_end )
+                    strip.src_end = clist.p[ j ].pixel + 1;
+            }
+        }
+
+        if( strip.src_beg >= strip.src_end )
+            strip.src_beg = strip.src_end = 0;
+
+        total += strip.src_end - strip.src_beg;
+        m_strips.push_back( strip );
     }
 
-    if( !Pclist_y )
+    if( total > 2 * m_intermediate_x )
+        m_strips.clear();
+}
+
+// Splits the destination samples into runs for resample_x_block(), so that the transposed source
+// columns of a run fit in half the level 1 cache, like a strip of init_strips(). A run always has at
+// least one destination sample, however many columns it reads.
+void Resampler::init_x_tiles()
+{
+    m_x_tiles.clear();
+
+    if( m_identity_x )
+        return;
+
+    unsigned int max_cols = g_l1_size / ( 2 * sizeof( Sample ) * BLOCK_ROWS );
+    if( max_cols < 16 )
+        max_cols = 16;
+
+    const unsigned int dst_w = m_dst_subrect_end_x - m_dst_subrect_beg_x;
+    Strip tile;
+    tile.dst_beg = 0;
+    tile.src_beg = 0;
+    tile.src_end = 0;
+
+    for( unsigned int i = 0; i < dst_w; i++ )
     {
-        m_Pclistc_y = make_clist( m_resample_src_h, m_resample_dst_h, m_boundary_op, func, support, filter_y_scale, src_y_ofs );
-        if( NULL == m_Pclistc_y.get() )
+        const Contrib_List& clist = m_Pclist_x[ i ];
+        if( !clist.n )
+            continue;
+
+        unsigned int lo = clist.p[ 0 ].pixel, hi = clist.p[ 0 ].pixel + 1;
+        for( unsigned int j = 1; j < clist.n; j++ )
         {
-            m_status = STATUS_OUT_OF_MEMORY;
-            return;
+            if( clist.p[ j ].pixel < lo )
+                lo = clist.p[ j ].pixel;
+            if( clist.p[ j ].pixel + 1 > hi )
+                hi = clist.p[ j ].pixel + 1;
         }
-        m_Pclist_y = &m_Pclistc_y->clists[ 0 ];
+
+        if( tile.src_beg < tile.src_end )
+        {
+            const unsigned int beg = ( lo < tile.src_beg ) ? lo : tile.src_beg;
+            const unsigned int end = ( hi > tile.src_end ) ? hi : tile.src_end;
+            if( end - beg <= max_cols )
+            {
+                tile.src_beg = beg;
+                tile.src_end = end;
+                continue;
+            }
+
+            tile.dst_end = i;
+            m_x_tiles.push_back( tile );
+            tile.dst_beg = i;
+        }
+
+        tile.src_beg = lo;
+        tile.src_end = hi;
     }
-    else
+
+    tile.dst_end = dst_w;
+    m_x_tiles.push_back( tile );
+}
+
+const Resampler_Simd_Kernels* resampler_simd_kernels()
+{
+    return g_Psimd;
+}
+
+const char* Resampler::get_simd_target()
+{
+    return g_Psimd ? g_Psimd->Pname : "scalar";
+}
+
+bool Resampler::set_simd_target( const char* Pname )
+{
+    if( !Pname )
+        return false;
+
+    if( strcmp( Pname, "scalar" ) == 0 )
     {
-        m_Pclist_y = Pclist_y;
+        g_Psimd = NULL;
+        return true;
     }
 
-    m_Psrc_y_count.resize( m_resample_src_h, 0 );
+    const Resampler_Simd_Kernels* Pkernels = find_simd_target( Pname );
+    if( !Pkernels )
+        return false;
 
-    m_Psrc_y_flag.resize( m_resample_src_h );
+    g_Psimd = Pkernels;
+    return true;
+}
 
-    // Count how many times each source line contributes to a destination line.
-    for( unsigned int i = 0; i < m_resample_dst_h; i++ )
-        for( unsigned int j = 0; j < m_Pclist_y[ i ].n; j++ )
-            m_Psrc_y_count[ m_Pclist_y[ i ].p[ j ].pixel ]++;
+unsigned int Resampler::get_filter_num()
+{
+    RESAMPLER_LOCK_FILTERS();
+    return NUM_FILTERS + ( unsigned int ) g_registered_filters.size();
+}
 
-    m_cur_src_y = 0;
-    m_cur_dst_y = m_dst_subrect_beg_y;
+const char* Resampler::get_filter_name( unsigned int filter_num )
+{
+    if( filter_num < NUM_FILTERS )
+        return g_filters[ filter_num ].name;
+
+    RESAMPLER_LOCK_FILTERS();
+    std::list< Registered_Filter >::const_iterator it = g_registered_filters.begin();
+    for( filter_num -= NUM_FILTERS; ( it != g_registered_filters.end() ) && filter_num; --filter_num )
+        ++it;
+    return ( it != g_registered_filters.end() ) ? it->name.c_str() : NULL;
+}
+
+// Looks up a built-in or registered filter. The returned pointers stay valid, filters are never removed.
+bool Resampler::find_filter( const char* Pname, Filter& filter )
+{
+    memset( &filter, 0, sizeof( filter ) );
+
+    for( unsigned int i = 0; i < NUM_FILTERS; i++ )
     {
-        // Determine which axis to resample first by comparing the number of multiplies required
-        // for each possibility.
-        unsigned int x_ops = count_ops( m_Pclist_x, m_resample_dst_w );
-        unsigned int y_ops = count_ops( m_Pclist_y, m_resample_dst_h );
+        if( Pname == g_filters[ i ].name )
+        {
+            filter.Pname = g_filters[ i ].name;
+            filter.Pfunc = g_filters[ i ].func;
+            filter.support = g_filters[ i ].support;
+            return true;
+        }
+    }
 
-        // Hack 10/2000: Weight Y axis ops a little more than X axis ops.
-        // (Y axis ops use more cache resources.)
-        unsigned int xy_ops = x_ops * m_resample_src_h +
-                              ( 4 * y_ops * m_resample_dst_w ) / 3;
+    RESAMPLER_LOCK_FILTERS();
 
-        unsigned int yx_ops = ( 4 * y_ops * m_resample_src_w ) / 3 +
-                              x_ops * m_resample_dst_h;
+    // Names returned by resolve_filter() are recognized by address, before any string compares.
+    std::list< Registered_Filter >::const_iterator it;
+    for( it = g_registered_filters.begin(); it != g_registered_filters.end(); ++it )
+    {
+        if( it->name.c_str() == Pname )
+            break;
+    }
 
-        // Now check which resample order is better. In case of a tie, choose the order
-        // which buffers the least amount of data.
-        if( ( xy_ops > yx_ops ) ||
-            ( ( xy_ops == yx_ops ) && ( m_resample_src_w < m_resample_dst_w ) )
-            )
+    if( it == g_registered_filters.end() )
+    {
+        for( unsigned int i = 0; i < NUM_FILTERS; i++ )
         {
-            m_delay_x_resample = true;
-            m_intermediate_x = m_resample_src_w;
+            if( strcmp( Pname, g_filters[ i ].name ) == 0 )
+            {
+                filter.Pname = g_filters[ i ].name;
+                filter.Pfunc = g_filters[ i ].func;
+                filter.support = g_filters[ i ].support;
+                return true;
+            }
         }
-        else
+
+        for( it = g_registered_filters.begin(); it != g_registered_filters.end(); ++it )
         {
-            m_delay_x_resample = false;
-            m_intermediate_x = ( m_dst_subrect_end_x - m_dst_subrect_beg_x );
+            if( it->name == Pname )
+                break;
         }
+        if( it == g_registered_filters.end() )
+            return false;
     }
 
-    if( m_delay_x_resample )
+    filter.Pname = it->name.c_str();
+    filter.support = it->support;
+    filter.Plut = &it->lut[ 0 ];
+    filter.hash = it->hash;
+    return true;
+}
+
+// Returns the name of the new filter, or NULL if the name is taken. With reuse, an existing
+// registered filter of that name is returned instead (it's the same parameterization).
+static const char* add_registered_filter( const char* Pname, Resample_Real support, std::vector< Resample_Real >& lut, bool reuse = false )
+{
+    // Same as the built-in filters.
+    for( unsigned int i = 0; i <= FILTER_LUT_SIZE; i++ )
+        lut[ i ] = clean( lut[ i ] );
+
+    RESAMPLER_LOCK_FILTERS();
+
+    for( unsigned int i = 0; i < NUM_FILTERS; i++ )
+        if( strcmp( Pname, g_filters[ i ].name ) == 0 )
+            return NULL;
+
+    for( std::list< Registered_Filter >::const_iterator it = g_registered_filters.begin(); it != g_registered_filters.end(); ++it )
+        if( it->name == Pname )
+            return reuse ? it->name.c_str() : NULL;
+
+    g_registered_filters.push_back( Registered_Filter() );
+    Registered_Filter& filter = g_registered_filters.back();
+    filter.name = Pname;
+    filter.support = support;
+    filter.lut.swap( lut );
+    filter.hash = clist_checksum( &support, sizeof( support ), clist_checksum( &filter.lut[ 0 ], filter.lut.size() * sizeof( Resample_Real ) ) ) | 1;
+    return filter.name.c_str();
+}
+
+bool Resampler::register_filter( const char* Pname, Filter_Func Pfunc, void* Pdata, Resample_Real support )
+{
+    if( !Pname || !*Pname || !Pfunc || !( support > 0.0f ) )
+        return false;
+
+    std::vector< Resample_Real > lut( FILTER_LUT_SIZE + 1 );
+    for( unsigned int i = 0; i <= FILTER_LUT_SIZE; i++ )
+        lut[ i ] = ( *Pfunc )( support * i / FILTER_LUT_SIZE, Pdata );
+
+    return add_registered_filter( Pname, support, lut ) != NULL;
+}
+
+bool Resampler::register_filter( const char* Pname, const Resample_Real* Pkernel, unsigned int num_samples, Resample_Real support )
+{
+    if( !Pname || !*Pname || !Pkernel || ( num_samples < 2 ) || !( support > 0.0f ) )
+        return false;
+
+    // Linearly interpolate the kernel to the table size.
+    std::vector< Resample_Real > lut( FILTER_LUT_SIZE + 1 );
+    for( unsigned int i = 0; i <= FILTER_LUT_SIZE; i++ )
     {
-        m_Ptmp_buf.resize( m_intermediate_x );
+        double x = ( double ) i * ( num_samples - 1 ) / FILTER_LUT_SIZE;
+        unsigned int j = ( unsigned int ) x;
+        if( j >= num_samples - 1 )
+            j = num_samples - 2;
+        lut[ i ] = ( Resample_Real ) ( Pkernel[ j ] + ( Pkernel[ j + 1 ] - Pkernel[ j ] ) * ( x - j ) );
     }
+
+    return add_registered_filter( Pname, support, lut ) != NULL;
 }
 
-unsigned int Resampler::get_filter_num()
+const char* Resampler::resolve_filter( const Filter_Desc& desc )
 {
-    return NUM_FILTERS;
+    const Resample_Real p0 = desc.param[ 0 ], p1 = desc.param[ 1 ];
+
+    char name[ 64 ];
+    Resample_Real support;
+    switch( desc.family )
+    {
+    case Filter_Desc::FAMILY_NAMED:
+    {
+        Filter filter;
+        return ( desc.Pname && find_filter( desc.Pname, filter ) ) ? filter.Pname : NULL;
+    }
+    case Filter_Desc::FAMILY_MITCHELL:
+        if( !( fabs( p0 ) <= 1000.0f ) || !( fabs( p1 ) <= 1000.0f ) )
+            return NULL;
+        sprintf( name, "mitchell(%.9g,%.9g)", p0, p1 );
+        support = MITCHELL_SUPPORT;
+        break;
+    case Filter_Desc::FAMILY_QUADRATIC:
+        if( !( fabs( p0 ) <= 1000.0f ) )
+            return NULL;
+        sprintf( name, "quadratic(%.9g)", p0 );
+        support = QUADRATIC_SUPPORT;
+        break;
+    case Filter_Desc::FAMILY_KAISER:
+        if( !( p0 >= 0.0f ) || ( p0 > 1000.0f ) )
+            return NULL;
+        sprintf( name, "kaiser(%.9g)", p0 );
+        support = KAISER_SUPPORT;
+        break;
+    case Filter_Desc::FAMILY_LANCZOS:
+        if( !( p0 >= 1.0f ) || ( p0 > 64.0f ) )
+            return NULL;
+        sprintf( name, "lanczos(%.9g)", p0 );
+        support = p0;
+        break;
+    default:
+        return NULL;
+    }
+
+    // Already tabulated?
+    {
+        RESAMPLER_LOCK_FILTERS();
+        for( std::list< Registered_Filter >::const_iterator it = g_registered_filters.begin(); it != g_registered_filters.end(); ++it )
+            if( it->name == name )
+                return it->name.c_str();
+    }
+
+    const double alpha = kaiser_alpha( p0 );
+
+    std::vector< Resample_Real > lut( FILTER_LUT_SIZE + 1 );
+    for( unsigned int i = 0; i <= FILTER_LUT_SIZE; i++ )
+    {
+        const Resample_Real t = support * i / FILTER_LUT_SIZE;
+        switch( desc.family )
+        {
+        case Filter_Desc::FAMILY_MITCHELL:
+            lut[ i ] = mitchell( t, p0, p1 );
+            break;
+        case Filter_Desc::FAMILY_QUADRATIC:
+            lut[ i ] = quadratic( t, p0 );
+            break;
+        case Filter_Desc::FAMILY_KAISER:
+            lut[ i ] = ( t < support ) ? ( Resample_Real ) ( sinc( t ) * kaiser( alpha, support, t ) ) : 0.0f;
+            break;
+        default:
+            lut[ i ] = ( t < support ) ? ( Resample_Real ) ( sinc( t ) * sinc( t / support ) ) : 0.0f;
+            break;
+        }
+    }
+
+    return add_registered_filter( name, support, lut, true );
 }
 
-const char* Resampler::get_filter_name( unsigned int filter_num )
+bool Resampler::is_replication
+    (
+    unsigned int src_w, unsigned int src_h,
+    unsigned int dst_w, unsigned int dst_h,
+    const char* Pfilter_name,
+    unsigned int& x_factor, unsigned int& y_factor,
+    Resample_Real filter_x_scale,
+    Resample_Real filter_y_scale,
+    Resample_Real src_x_ofs,
+    Resample_Real src_y_ofs
+    )
 {
-    if( ( filter_num < 0 ) || ( filter_num >= NUM_FILTERS ) )
-        return NULL;
-    else
-        return g_filters[ filter_num ].name;
+    x_factor = y_factor = 0;
+
+    if( ( Pfilter_name == NULL ) || ( strcmp( Pfilter_name, "box" ) != 0 ) )
+        return false;
+
+    if( ( filter_x_scale != 1.0f ) || ( filter_y_scale != 1.0f ) || ( src_x_ofs != 0.0f ) || ( src_y_ofs != 0.0f ) )
+        return false;
+
+    if( ( !src_w ) || ( !src_h ) || ( dst_w < src_w ) || ( dst_h < src_h ) || ( dst_w % src_w ) || ( dst_h % src_h ) )
+        return false;
+
+    // With a whole factor the box filter's edges never fall on a source sample, so every
+    // destination sample gets exactly one contributor with a weight of 1.0.
+    x_factor = dst_w / src_w;
+    y_factor = dst_h / src_h;
+    return true;
+}
+
+// Replicates destination samples [beg, beg + n) of a line upsampled by x_factor.
+static void replicate_line( unsigned char* Pdst, const unsigned char* Psrc, unsigned int comps, unsigned int x_factor, unsigned int beg, unsigned int n )
+{
+    Psrc += ( beg / x_factor ) * comps;
+    unsigned int left = x_factor - ( beg % x_factor );
+
+#if defined( __SSE2__ ) || defined( _M_X64 )
+    // The most common cases, 2x and 4x grayscale and RGBA, 16 source bytes at a time.
+    if( ( ( x_factor == 2 ) || ( x_factor == 4 ) ) && ( left == x_factor ) && ( ( comps == 1 ) || ( comps == 4 ) ) )
+    {
+        const unsigned int step = 16 * x_factor;
+        const unsigned int bytes = ( n * comps ) / step * step;
+        unsigned char* Pend = Pdst + bytes;
+
+        if( ( comps == 1 ) && ( x_factor == 2 ) )
+        {
+            for( ; Pdst < Pend; Pdst += 32, Psrc += 16 )
+            {
+                const __m128i s = _mm_loadu_si128( ( const __m128i* ) Psrc );
+                _mm_storeu_si128( ( __m128i* ) Pdst, _mm_unpacklo_epi8( s, s ) );
+                _mm_storeu_si128( ( __m128i* ) ( Pdst + 16 ), _mm_unpackhi_epi8( s, s ) );
+            }
+        }
+        else if( comps == 1 )
+        {
+            for( ; Pdst < Pend; Pdst += 64, Psrc += 16 )
+            {
+                const __m128i s = _mm_loadu_si128( ( const __m128i* ) Psrc );
+                const __m128i lo = _mm_unpacklo_epi8( s, s );
+                const __m128i hi = _mm_unpackhi_epi8( s, s );
+                _mm_storeu_si128( ( __m128i* ) Pdst, _mm_unpacklo_epi16( lo, lo ) );
+                _mm_storeu_si128( ( __m128i* ) ( Pdst + 16 ), _mm_unpackhi_epi16( lo, lo ) );
+                _mm_storeu_si128( ( __m128i* ) ( Pdst + 32 ), _mm_unpacklo_epi16( hi, hi ) );
+                _mm_storeu_si128( ( __m128i* ) ( Pdst + 48 ), _mm_unpackhi_epi16( hi, hi ) );
+            }
+        }
+        else if( x_factor == 2 )
+        {
+            for( ; Pdst < Pend; Pdst += 32, Psrc += 16 )
+            {
+                const __m128i s = _mm_loadu_si128( ( const __m128i* ) Psrc );
+                _mm_storeu_si128( ( __m128i* ) Pdst, _mm_unpacklo_epi32( s, s ) );
+                _mm_storeu_si128( ( __m128i* ) ( Pdst + 16 ), _mm_unpackhi_epi32( s, s ) );
+            }
+        }
+        else
+        {
+            for( ; Pdst < Pend; Pdst += 64, Psrc += 16 )
+            {
+                const __m128i s = _mm_loadu_si128( ( const __m128i* ) Psrc );
+                _mm_storeu_si128( ( __m128i* ) Pdst, _mm_shuffle_epi32( s, 0x00 ) );
+                _mm_storeu_si128( ( __m128i* ) ( Pdst + 16 ), _mm_shuffle_epi32( s, 0x55 ) );
+                _mm_storeu_si128( ( __m128i* ) ( Pdst + 32 ), _mm_shuffle_epi32( s, 0xAA ) );
+                _mm_storeu_si128( ( __m128i* ) ( Pdst + 48 ), _mm_shuffle_epi32( s, 0xFF ) );
+            }
+        }
+
+        n -= bytes / comps;
+    }
+#endif
+
+    switch( comps )
+    {
+        case 1:
+        {
+            for( unsigned int i = 0; i < n; i++ )
+            {
+                Pdst[ i ] = *Psrc;
+                if( !--left )
+                {
+                    Psrc++;
+                    left = x_factor;
+                }
+            }
+            break;
+        }
+        case 4:
+        {
+            for( unsigned int i = 0; i < n; i++, Pdst += 4 )
+            {
+                memcpy( Pdst, Psrc, 4 );
+                if( !--left )
+                {
+                    Psrc += 4;
+                    left = x_factor;
+                }
+            }
+            break;
+        }
+        default:
+        {
+            for( unsigned int i = 0; i < n; i++, Pdst += comps )
+            {
+                for( unsigned int c = 0; c < comps; c++ )
+                    Pdst[ c ] = Psrc[ c ];
+                if( !--left )
+                {
+                    Psrc += comps;
+                    left = x_factor;
+                }
+            }
+            break;
+        }
+    }
+}
+
+void Resampler::replicate
+    (
+    const unsigned char* Psrc, unsigned int src_pitch,
+    unsigned char* Pdst, unsigned int dst_pitch,
+    unsigned int comps,
+    unsigned int x_factor, unsigned int y_factor,
+    unsigned int dst_subrect_x, unsigned int dst_subrect_y,
+    unsigned int dst_subrect_w, unsigned int dst_subrect_h
+    )
+{
+    assert( x_factor && y_factor );
+
+    const unsigned int line_bytes = dst_subrect_w * comps;
+    const unsigned char* Pfirst = NULL;
+
+    for( unsigned int y = dst_subrect_y; y < dst_subrect_y + dst_subrect_h; y++, Pdst += dst_pitch )
+    {
+        // Expand each source line once, then copy it for the remaining destination lines.
+        if( ( y == dst_subrect_y ) || ( y % y_factor == 0 ) )
+        {
+            replicate_line( Pdst, Psrc + ( size_t ) ( y / y_factor ) * src_pitch, comps, x_factor, dst_subrect_x, dst_subrect_w );
+            Pfirst = Pdst;
+        }
+        else
+            memcpy( Pdst, Pfirst, line_bytes );
+    }
 }
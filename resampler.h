@@ -6,6 +6,7 @@
 #include <vector>
 #include <memory>
 #include <map>
+#include <cstdio>
 
 #define RESAMPLER_DEFAULT_FILTER "lanczos4"
 
@@ -20,7 +21,7 @@ public:
     struct Contrib
     {
         Resample_Real weight;
-        unsigned short pixel;
+        unsigned int pixel;
     };
 
     struct Contrib_List
@@ -50,6 +51,27 @@ public:
     // sample_low/sample_high - Clamp output samples to specified range, or disable clamping if sample_low >= sample_high
     // Pclist_x/Pclist_y - Optional pointers to contributor lists from another instance of a Resampler
     // src_x_ofs/src_y_ofs - Offset input image by specified amount (fractional values okay)
+    // dst_subrect_x/y/w/h - Only generate this rectangle of the output image (ignored if empty or out of bounds)
+    // max_tap_error - Drop the smallest contributors at the tails of each output sample's filter, as long as
+    //                 the sum of their absolute weights stays within this amount (0 keeps every contributor)
+    // continuous_y - Endless stream of source lines: every src_h source lines make dst_h destination lines
+    //                (reduce the ratio, it's the period of the Y axis contributor lists). There's no bottom
+    //                boundary, BOUNDARY_WRAP clamps at the top, and the Y part of the dst subrect is ignored.
+    // max_scan_buf_size - Maximum number of bytes of buffered lines to keep in memory (0 for no limit). Further
+    //                     lines are spilled to a temporary file, and read back a strip at a time when they're
+    //                     summed, which costs a file write and one read per use of each spilled line.
+    //                     The cap applies to both Y axis engines. When downsampling, partial sums of the
+    //                     destination lines may be kept instead of source lines; they can't be spilled,
+    //                     so that engine is only picked when its peak fits under the cap.
+    // clist_threads - Build the contributor lists on this many background threads (0 builds them in the
+    //                 constructor). Until they're done, put_line() queues the source lines, and the other
+    //                 methods wait for them. If a queued line then fails, status() reports it and the
+    //                 following put_line() calls return false.
+    // skip_constant_regions - Find the runs of equal samples in each line, and write output samples whose
+    //                         contributors all fall inside one (or have the same value on every contributing
+    //                         line) directly instead of filtering them. The weights sum to 1, so that's the
+    //                         filtered value, up to the rounding of the sum. Lines go through put_line() and
+    //                         get_line() one at a time, and the Y axis always gathers its source lines.
     Resampler
         (
         unsigned int src_w, unsigned int src_h,
@@ -65,25 +87,157 @@ public:
         Resample_Real src_x_ofs = 0.0f,
         Resample_Real src_y_ofs = 0.0f,
         unsigned int dst_subrect_x = 0, unsigned int dst_subrect_y = 0,
-        unsigned int dst_subrect_w = 0, unsigned int dst_subrect_h = 0
+        unsigned int dst_subrect_w = 0, unsigned int dst_subrect_h = 0,
+        Resample_Real max_tap_error = 0.0f,
+        bool continuous_y = false,
+        size_t max_scan_buf_size = 0,
+        unsigned int clist_threads = 0,
+        bool skip_constant_regions = false
 		);
 
-    // false on out of memory.
+    ~Resampler();
+
+    // false on out of memory, or if a line couldn't be spilled (status() is then STATUS_SCAN_BUFFER_FULL),
+    // or if status() isn't STATUS_OKAY.
+    // In continuous_y mode, false if get_line() must be called first (the line isn't taken), the scan
+    // buffer only holds about one filter window of lines.
     bool put_line(const Sample* Psrc);
 
+    // Supplies count source lines at once, spaced src_pitch samples apart. Equivalent to count
+    // calls to put_line(), but in X-Y order the lines are resampled on the X axis together.
+    // false if this would go past the last source line (continuous_y: if they don't all fit).
+    bool put_lines(const Sample* Psrc, unsigned int count, unsigned int src_pitch);
+
     // NULL if no scanlines are currently available (give the resampler more scanlines!)
     const Sample* get_line();
 
-    Status status() const { return m_status; }
+    // Generates up to max_lines destination lines into Pdst, spaced dst_pitch samples apart.
+    // Consecutive lines are computed together, so source lines shared by their Y axis
+    // contributors are only read once. Returns the number of lines generated, 0 if no
+    // lines are currently available.
+    unsigned int get_lines(Sample* Pdst, unsigned int dst_pitch, unsigned int max_lines);
+
+    // Resamples a whole image in one call, instead of feeding it through put_line()/get_line().
+    // Psrc holds src_h lines spaced src_pitch samples apart, Pdst receives the lines of the
+    // destination subrect spaced dst_pitch samples apart. The X axis is resampled on transposed
+    // blocks of lines, which avoids the per-line gathers of resample_x().
+    // false on out of memory, if put_line() was already called on this instance, or in continuous_y mode.
+    bool resample_image(const Sample* Psrc, unsigned int src_pitch, Sample* Pdst, unsigned int dst_pitch);
+
+    Status status() const { join_clists(); return m_status; }
+
+    struct Stats
+    {
+        // Contributors dropped by max_tap_error from the lists built by this instance.
+        unsigned int pruned_taps_x;
+        unsigned int pruned_taps_y;
+
+        // Lines written to the spill file because of max_scan_buf_size.
+        unsigned int spilled_lines;
 
-    // Returned contributor lists can be shared with another Resampler.
-    Contrib_List* get_clist_x() const { return &m_Pclistc_x.get()->clists[ 0 ]; }
-    Contrib_List* get_clist_y() const { return &m_Pclistc_y.get()->clists[ 0 ]; }
+        // With skip_constant_regions, the X and Y axis output samples written directly, and the
+        // ones filtered as usual.
+        unsigned long long const_samples;
+        unsigned long long filtered_samples;
 
-    // Filter accessors.
+        double const_ratio() const { return ( const_samples + filtered_samples ) ? ( double ) const_samples / ( const_samples + filtered_samples ) : 0.0; }
+    };
+
+    const Stats& stats() const { join_clists(); return m_stats; }
+
+    // Returned contributor lists can be shared with another Resampler. The lists only cover the
+    // destination subrect (starting with its first sample), so the other Resampler must use the
+    // same dimensions and subrect.
+    Contrib_List* get_clist_x() const { join_clists(); return &m_Pclistc_x.get()->clists[ 0 ]; }
+    Contrib_List* get_clist_y() const { join_clists(); return &m_Pclistc_y.get()->clists[ 0 ]; }
+
+    // Contributor list cache. The lists built by Resamplers are stored in this directory, and Resamplers
+    // with the same settings memory map them (read-only, so the pages are shared between processes)
+    // instead of building them again. NULL disables the cache (the default). Set it before creating
+    // any Resamplers, it isn't thread safe.
+    // Loading a file only checks its header, key and size, so its pages are read as the lists are
+    // used, and a file damaged in place goes unnoticed. verify also checks the checksum written
+    // with each file, which reads all of it.
+    static void set_clist_cache_dir(const char* Pdir, bool verify = false);
+
+    // SIMD kernels. The vertical accumulation, the clamp and the X axis block kernel run on the best
+    // target the CPU supports ("avx2", "sse4.1" or "neon", when compiled in), otherwise on the
+    // scalar reference code ("scalar").
+    static const char* get_simd_target();
+
+    // Forces a target, e.g. "scalar" to compare against the reference code. false if the target
+    // isn't available. Call it before creating Resamplers, it isn't thread safe.
+    static bool set_simd_target(const char* Pname);
+
+    // Filter accessors. Registered filters follow the built-in ones.
     static unsigned int get_filter_num();
     static const char* get_filter_name(unsigned int filter_num);
 
+    // Custom filters. The filter is sampled once into a lookup table over [0, support], which is
+    // what contributor lists are built from, so Pdata only needs to live for the call. Filters
+    // are symmetric, only |t| is looked up. A sampled kernel gives num_samples (>= 2) evenly spaced
+    // values for t = 0 to support. Returns false if the name is already taken or the arguments
+    // are bad. Registration is thread safe when built with threads (RESAMPLER_THREADS).
+    typedef Resample_Real (*Filter_Func)(Resample_Real t, void* Pdata);
+    static bool register_filter(const char* Pname, Filter_Func Pfunc, void* Pdata, Resample_Real support);
+    static bool register_filter(const char* Pname, const Resample_Real* Pkernel, unsigned int num_samples, Resample_Real support);
+
+    // Parameterized filters, for tuning a filter family without registering each variant by hand.
+    struct Filter_Desc
+    {
+        enum Family
+        {
+            FAMILY_NAMED = 0,       // Pname: a built-in or registered filter
+            FAMILY_MITCHELL = 1,    // param[ 0 ], param[ 1 ]: B, C (finite, within +-1000)
+            FAMILY_QUADRATIC = 2,   // param[ 0 ]: R (finite, within +-1000)
+            FAMILY_KAISER = 3,      // param[ 0 ]: stopband attenuation in dB
+            FAMILY_LANCZOS = 4      // param[ 0 ]: number of lobes (>= 1)
+        };
+
+        Family family;
+        const char* Pname;
+        Resample_Real param[ 2 ];
+
+        static Filter_Desc named(const char* Pname) { Filter_Desc d = { FAMILY_NAMED, Pname, { 0.0f, 0.0f } }; return d; }
+        static Filter_Desc mitchell(Resample_Real B, Resample_Real C) { Filter_Desc d = { FAMILY_MITCHELL, NULL, { B, C } }; return d; }
+        static Filter_Desc quadratic(Resample_Real R) { Filter_Desc d = { FAMILY_QUADRATIC, NULL, { R, 0.0f } }; return d; }
+        static Filter_Desc kaiser(Resample_Real attenuation) { Filter_Desc d = { FAMILY_KAISER, NULL, { attenuation, 0.0f } }; return d; }
+        static Filter_Desc lanczos(Resample_Real lobes) { Filter_Desc d = { FAMILY_LANCZOS, NULL, { lobes, 0.0f } }; return d; }
+    };
+
+    // Resolves a descriptor to a filter, tabulating each parameterization the first time it's seen
+    // (like register_filter(), the name is e.g. "mitchell(0.5,0.25)"). The returned name stays valid
+    // and is the filter's handle: pass it as Pfilter_name, Resamplers recognize it without comparing
+    // strings, and it's what the contributor list cache is keyed on. NULL if the parameters are bad.
+    // Thread safe like register_filter().
+    static const char* resolve_filter(const Filter_Desc& desc);
+
+    // Pixel replication fast path for 8-bit images.
+    // Upsampling by whole factors with the "box" filter, no filter scaling and no offset just
+    // replicates each source pixel, so there's no need to go through floats at all.
+    // is_replication() returns the X/Y factors if a Resampler with these settings would do that.
+    static bool is_replication(
+        unsigned int src_w, unsigned int src_h,
+        unsigned int dst_w, unsigned int dst_h,
+        const char* Pfilter_name,
+        unsigned int& x_factor, unsigned int& y_factor,
+        Resample_Real filter_x_scale = 1.0f,
+        Resample_Real filter_y_scale = 1.0f,
+        Resample_Real src_x_ofs = 0.0f,
+        Resample_Real src_y_ofs = 0.0f);
+
+    // Writes the destination subrect of an image upsampled by x_factor/y_factor with pixel
+    // replication. Psrc/Pdst hold interleaved 8-bit pixels with comps bytes each, src_pitch
+    // and dst_pitch are in bytes. The result is identical to the output of a Resampler for
+    // which is_replication() is true (with unclamped, unmodified samples).
+    static void replicate(
+        const unsigned char* Psrc, unsigned int src_pitch,
+        unsigned char* Pdst, unsigned int dst_pitch,
+        unsigned int comps,
+        unsigned int x_factor, unsigned int y_factor,
+        unsigned int dst_subrect_x, unsigned int dst_subrect_y,
+        unsigned int dst_subrect_w, unsigned int dst_subrect_h);
+
 private:
     Resampler();
     Resampler(const Resampler& o);
@@ -106,45 +260,248 @@ private:
     std::vector< Sample > m_Pdst_buf;
     std::vector< Sample > m_Ptmp_buf;
 
+    // Number of lines resample_x_block() processes together.
+    enum { BLOCK_ROWS = 8 };
+    std::vector< Sample > m_Ptile_buf;
+
     struct Contrib_List_Container
     {
         std::vector< Contrib > cpool;
         std::vector< Contrib_List > clists;
+        unsigned int num_pruned;
+        int pixel_ofs;
+
+        // Lists loaded from the cache point into a read-only file mapping instead of cpool.
+        void* Pmapping;
+        size_t mapping_size;
+
+        Contrib_List_Container() : num_pruned( 0 ), pixel_ofs( 0 ), Pmapping( NULL ), mapping_size( 0 ) { }
+        ~Contrib_List_Container();
     };
     std::auto_ptr< Contrib_List_Container > m_Pclistc_x;
     std::auto_ptr< Contrib_List_Container > m_Pclistc_y;
 
+    // Y-X order source column cropping, see crop_src_x().
+    std::auto_ptr< Contrib_List_Container > m_Pclistc_x_crop;
+    unsigned int m_src_x_beg;
+
+    void crop_src_x(unsigned int src_x_beg, unsigned int src_x_end);
+
+    // Continuous Y axis mode, see init_continuous_y().
+    bool m_continuous_y;
+    unsigned int m_src_y_end;
+    unsigned int m_cont_period;
+    unsigned int m_cont_row0;
+    Contrib_List* m_Pclist_y_period;
+    std::vector< unsigned int > m_cont_uses;
+    std::vector< std::vector< unsigned int > > m_cont_top_uses;
+    std::auto_ptr< Contrib_List_Container > m_Pclistc_y_top;
+
+    void init_continuous_y();
+    unsigned int resolve_y(unsigned int pixel, unsigned int period) const;
+    unsigned int cont_count(unsigned int src_y) const;
+    void set_period_clist_y();
+    void next_period();
+
     Contrib_List* m_Pclist_x;
     Contrib_List* m_Pclist_y;
 
     bool m_delay_x_resample;
 
+    // Axes which don't need resampling, see is_identity().
+    bool m_identity_x;
+    bool m_identity_y;
+
+    // With an identity Y axis, put_line() resamples the next destination line on the X axis into
+    // m_pass_buf, and get_line() swaps it with m_Pdst_buf. m_pass_ready if it holds m_cur_dst_y.
+    std::vector< Sample > m_pass_buf;
+    bool m_pass_ready;
+
+    static bool is_identity(const Contrib_List* Pclist, unsigned int beg, unsigned int end);
+
+    // Contributor list of destination line dst_y, the Y axis lists start at the subrect's first line.
+    const Contrib_List& clist_y(unsigned int dst_y) const { return m_Pclist_y[ dst_y - m_dst_subrect_beg_y ]; }
+
     std::vector< int > m_Psrc_y_count;
     std::vector< bool > m_Psrc_y_flag;
 
     std::map< int, std::vector< Sample > > m_Pscan_buf;
 
+    std::vector< const Sample* > m_Psrc_y_lines;
+
+    // Scattering Y axis engine, see init_scatter_y().
+    struct Scatter_Contrib
+    {
+        unsigned int dst_y;
+        Resample_Real weight;
+    };
+    bool m_scatter_y;
+    std::vector< unsigned int > m_scatter_beg;
+    std::vector< Scatter_Contrib > m_scatter;
+    std::vector< unsigned int > m_dst_y_count;
+    std::map< int, std::vector< Sample > > m_Paccum_buf;
+
+    void init_scatter_y();
+    void scatter_y(const Sample* Psrc);
+
+    // Lines spilled to disk because of m_max_scan_buf_size, see spill_line().
+    size_t m_max_scan_buf_size;
+    FILE* m_Pspill_file;
+    std::map< int, unsigned int > m_spill_slots;
+    std::vector< unsigned int > m_free_spill_slots;
+    unsigned int m_num_spill_slots;
+    std::vector< Sample > m_spill_line;
+
+    bool spill_line(int src_y);
+    const Sample* read_spilled_line(int src_y, unsigned int beg, unsigned int n);
+
+    // Strip mining of very wide lines, see init_strips().
+    enum { MIN_STRIP_W = 256 };
+    struct Strip
+    {
+        unsigned int dst_beg, dst_end;
+        unsigned int src_beg, src_end;
+    };
+    unsigned int m_strip_w;
+    std::vector< Strip > m_strips;
+
+    void init_strips();
+
+    // The runs of destination samples whose source columns resample_x_block() transposes together.
+    std::vector< Strip > m_x_tiles;
+
+    void init_x_tiles();
+
     unsigned int m_cur_src_y;
     unsigned int m_cur_dst_y;
 
     Status m_status;
-
-    void resample_x(Sample* Pdst, const Sample* Psrc);
+    Stats m_stats;
+
+    void resample_x(Sample* Pdst, const Sample* Psrc, unsigned int beg, unsigned int end);
+
+    // Sliding window X axis resampling when upsampling, see init_upsample_x().
+    enum { MAX_UPSAMPLE_TAPS = 8, MIN_UPSAMPLE_RUN = 16 };
+    unsigned int m_upsample_taps;
+    unsigned int m_upsample_beg;
+    unsigned int m_upsample_end;
+    std::vector< unsigned int > m_upsample_base;
+    std::vector< Resample_Real > m_upsample_weights;
+
+    void init_upsample_x();
+    void resample_x_upsample(Sample* Pdst, const Sample* Psrc, unsigned int beg, unsigned int end);
+    enum { PUT_LINES_ROWS = 4 };
+    void resample_x_lines(Sample* const* Pdst, const Sample* const* Psrc);
+    void resample_x_block(Sample* const* Pdst, const Sample* const* Psrc, unsigned int n);
     static void scale_y_mov(Sample* Ptmp, const Sample* Psrc, Resample_Real weight, unsigned int dst_w);
     static void scale_y_add(Sample* Ptmp, const Sample* Psrc, Resample_Real weight, unsigned int dst_w);
     static void clamp(Sample* Pdst, unsigned int n, Resample_Real lo, Resample_Real hi);
+    void find_y_lines();
+    void accumulate_y(Sample* Ptmp, unsigned int beg, unsigned int end);
+
+    // Constant region skipping, see skip_constant_regions. Runs shorter than MIN_CONST_RUN samples
+    // aren't worth tracking.
+    enum { MIN_CONST_RUN = 8 };
+    struct Const_Span
+    {
+        unsigned int beg, end;
+        Sample value;
+    };
+    bool m_skip_constant;
+    std::vector< unsigned int > m_clist_x_lo;   // smallest and largest contributor of each X list
+    std::vector< unsigned int > m_clist_x_hi;
+    std::map< int, std::vector< Const_Span > > m_const_spans;  // of the buffered lines
+    std::vector< Const_Span > m_src_spans;
+    std::vector< Const_Span > m_y_spans;        // where all the current Y contributors are equal
+    std::vector< Const_Span > m_tmp_spans;
+
+    static void find_const_spans(const Sample* Psrc, unsigned int n, std::vector< Const_Span >& spans);
+    void resample_x_const(Sample* Pdst, const Sample* Psrc, const std::vector< Const_Span >& spans, unsigned int beg, unsigned int end);
+    void find_y_const_spans();
+    void accumulate_y_const(Sample* Ptmp, unsigned int beg, unsigned int end);
+    void release_y_lines();
     void resample_y(Sample* Pdst);
+    bool line_ready(unsigned int dst_y) const;
+
+    // Multiple line Y axis sweeps, see get_lines().
+    enum { MAX_SWEEP_LINES = 4, SWEEP_CHUNK_W = 1024 };
+    struct Sweep_Contrib
+    {
+        unsigned int src_y;
+        unsigned int line;
+        Resample_Real weight;
+    };
+    std::vector< Sweep_Contrib > m_sweep;
+
+    static bool sweep_less(const Sweep_Contrib& a, const Sweep_Contrib& b) { return a.src_y < b.src_y; }
+
+    bool clist_y_sorted(unsigned int dst_y) const;
+    void accumulate_y_lines(Sample* const* Ptmp, unsigned int k);
+    static void scale_y_add_lines(Sample* const* Ptmp, const Resample_Real* weights, unsigned int num, const Sample* Psrc, unsigned int beg, unsigned int n);
 
     static int reflect(const int j, const int src_w, const Boundary_Op boundary_op);
 
+    // Contributor list construction, possibly in the background, see build_clists().
+    enum { MIN_THREAD_CLISTS = 1024 };
+    struct Contrib_Bounds;
+    struct Clist_Range;
+    struct Clist_Builder;
+    Clist_Builder* m_Pbuilder;
+    std::vector< std::vector< Sample > > m_pending_lines;
+
+    static void clist_thread(Resampler* Presampler);
+    void build_clists(const Clist_Builder& builder);
+    static void build_clist_x(Resampler* Presampler, const Clist_Builder& builder, unsigned int num_threads, bool* Pok);
+    static void build_clist_y(Resampler* Presampler, const Clist_Builder& builder, unsigned int num_threads, bool* Pok);
+    void init_resample();
+    bool clists_ready(bool wait);
+    void join_clists() const;
+    static void make_clist_range(Clist_Range& range);
+
+    // On-disk contributor list cache, see make_cached_clist().
+    struct Clist_Key;
+    struct Filter;
+    static bool find_filter(const char* Pname, Filter& filter);
+    static std::auto_ptr< Contrib_List_Container > load_clist(const char* Ppath, const Clist_Key& key);
+    static void save_clist(const char* Ppath, const Clist_Key& key, const Contrib_List_Container& clcont);
+
+    static std::auto_ptr< Contrib_List_Container > make_cached_clist
+        (
+        unsigned int src_w, unsigned int dst_w,
+        unsigned int dst_beg, unsigned int dst_end,
+        Boundary_Op boundary_op,
+        const Filter& filter,
+        Resample_Real filter_scale,
+        Resample_Real src_ofs,
+        Resample_Real max_error,
+        bool unbounded,
+        unsigned int num_threads
+        );
+
+    // The lists of one axis without a Resampler around them, for Resampler_Crops.
+    friend class Resampler_Crops;
+    static std::auto_ptr< Contrib_List_Container > make_axis_clist
+        (
+        unsigned int src_w, unsigned int dst_w,
+        unsigned int dst_beg, unsigned int dst_end,
+        Boundary_Op boundary_op,
+        const char* Pfilter_name,
+        Resample_Real filter_scale,
+        Resample_Real src_ofs,
+        Status& status
+        );
+
     static std::auto_ptr< Contrib_List_Container > make_clist
         (
         unsigned int src_w, unsigned int dst_w,
+        unsigned int dst_beg, unsigned int dst_end,
         Boundary_Op boundary_op,
-        Resample_Real (*Pfilter)(Resample_Real),
-        Resample_Real filter_support,
+        const Filter& filter,
         Resample_Real filter_scale,
-        Resample_Real src_ofs
+        Resample_Real src_ofs,
+        Resample_Real max_error,
+        bool unbounded,
+        unsigned int num_threads
         );
 
     static inline unsigned int count_ops(Contrib_List* Pclist, unsigned int k)
@@ -168,6 +525,347 @@ private:
     }
 };
 
+// Gamma correct resampler for 8-bit images with interleaved channels, working on 16-bit integers.
+// Samples are decoded through a table to LINEAR_BITS linear light integers, filtered with
+// WEIGHT_BITS fixed point weights (Y axis first, with the SIMD kernels), and encoded back
+// through a table indexed by the linear value. For source gammas up to 1.75 (the default, as in
+// test.cpp) the output is within 1 of the float path (a Resampler per channel fed
+// pow(x / 255, source_gamma), encoded with pow(x, 1 / source_gamma)). Higher gammas squeeze the
+// darkest codes into the first few linear steps: from 1.8 they can be off by 2, at 2.2 by up to 4.
+// Even 16 linear bits leave 2.2 off by 2 near black, where the rounding of the decoded samples and
+// of the weights is steeply magnified. The contributor lists come from a Resampler, so filters,
+// scales and subrects work the same. Copies share nothing, so each thread can use its
+// own, and copying is much cheaper than building the tables again.
+class Resampler_U8
+{
+public:
+    enum { LINEAR_BITS = 14, WEIGHT_BITS = 14 };
+
+    // R'G'B' to Y'CbCr matrices of resample_image_yuv420(), studio range (Y' 16..235, Cb/Cr 16..240).
+    enum Yuv_Matrix
+    {
+        YUV_BT601,
+        YUV_BT709
+    };
+
+    // num_channels - Bytes per pixel
+    // source_gamma - 1.0 resamples the samples as they are
+    // alpha_channel - This channel is resampled without gamma correction, -1 for none
+    // See Resampler for the rest.
+    Resampler_U8
+        (
+        unsigned int src_w, unsigned int src_h,
+        unsigned int dst_w, unsigned int dst_h,
+        unsigned int num_channels,
+        Resample_Real source_gamma = 1.75f,
+        int alpha_channel = -1,
+        Resampler::Boundary_Op boundary_op = Resampler::BOUNDARY_CLAMP,
+        const char* Pfilter_name = RESAMPLER_DEFAULT_FILTER,
+        Resample_Real filter_x_scale = 1.0f,
+        Resample_Real filter_y_scale = 1.0f,
+        unsigned int dst_subrect_x = 0, unsigned int dst_subrect_y = 0,
+        unsigned int dst_subrect_w = 0, unsigned int dst_subrect_h = 0,
+        Resample_Real src_x_ofs = 0.0f,
+        Resample_Real src_y_ofs = 0.0f
+        );
+
+    Resampler::Status status() const { return m_status; }
+
+    // Psrc holds src_h lines of src_w pixels, Pdst receives the lines of the destination subrect.
+    // Pitches are in bytes. false if status() isn't STATUS_OKAY.
+    bool resample_image(const unsigned char* Psrc, unsigned int src_pitch, unsigned char* Pdst, unsigned int dst_pitch);
+
+    // Same as resample_image(), but converts the encoded R'G'B' destination lines (channels 0, 1 and 2,
+    // the rest are ignored) straight to Y'CbCr 4:2:0 planes: Py gets the subrect's Y' samples, Pu and Pv
+    // the 2x2 averaged Cb and Cr samples, (w + 1) / 2 by (h + 1) / 2 (centered chroma, like JPEG and
+    // MPEG-1). If Pv is NULL, Pu gets interleaved Cb/Cr pairs instead (NV12). Pitches are in bytes.
+    // false if status() isn't STATUS_OKAY, or there are fewer than 3 channels.
+    bool resample_image_yuv420(const unsigned char* Psrc, unsigned int src_pitch,
+                               unsigned char* Py, unsigned int y_pitch,
+                               unsigned char* Pu, unsigned int u_pitch,
+                               unsigned char* Pv, unsigned int v_pitch,
+                               Yuv_Matrix matrix = YUV_BT601);
+
+    // Element types of resample_image_chw().
+    enum Tensor_Type
+    {
+        TENSOR_FLOAT32,
+        TENSOR_FLOAT16          // IEEE half floats, stored as unsigned shorts
+    };
+
+    // A planar CHW tensor: num_channels planes of w by h elements. The encoded sample s of channel c is
+    // written as ( s / 255 - mean[ c ] ) / std[ c ], and the canvas around the destination is filled
+    // with the pad sample of each channel, normalized the same way.
+    struct Tensor_Format
+    {
+        Tensor_Type type;
+        unsigned int w, h;
+        const float* Pmean;         // NULL for 0
+        const float* Pstd;          // NULL for 1
+        const unsigned char* Ppad;  // NULL for 0
+    };
+
+    // Same as resample_image(), but writes the destination lines (the subrect's, if there is one) at x, y
+    // in the planes of a CHW tensor, and pads the rest of the canvas. false if status() isn't STATUS_OKAY,
+    // or the destination doesn't fit in the canvas.
+    bool resample_image_chw(const unsigned char* Psrc, unsigned int src_pitch, void* Pdst, const Tensor_Format& format, unsigned int x, unsigned int y);
+
+    // One image of resample_batch_chw(). Each image needs its own resampler, they can differ in size.
+    struct Batch_Image
+    {
+        Resampler_U8* Presampler;
+        const unsigned char* Psrc;
+        unsigned int src_pitch;
+        unsigned int x, y;
+    };
+
+    // Fills an NCHW tensor with n images, image k goes to the CHW tensor at element k * num_channels * w * h.
+    // The images are split over num_threads threads (when built with threads). All the resamplers must
+    // have the same number of channels. false if any image fails, the others are still written.
+    static bool resample_batch_chw(const Batch_Image* Pimages, unsigned int n, void* Pdst, const Tensor_Format& format, unsigned int num_threads = 1);
+
+    // The size of a src_w by src_h image scaled to fit a canvas_w by canvas_h canvas, keeping its aspect
+    // ratio, and its position centered in the canvas (letterboxing).
+    static void letterbox(unsigned int src_w, unsigned int src_h, unsigned int canvas_w, unsigned int canvas_h,
+                          unsigned int& dst_w, unsigned int& dst_h, unsigned int& x, unsigned int& y);
+
+private:
+
+    // Fixed point contributor lists, the contributors of sample i are [beg[ i ], beg[ i + 1 ]).
+    struct Int_Clists
+    {
+        std::vector< unsigned int > beg;
+        std::vector< unsigned int > pixel;
+        std::vector< short > weight;
+    };
+
+    static void make_int_clists(const Resampler::Contrib_List* Pclists, unsigned int n, unsigned int pixel_mul, Int_Clists& clists);
+    const short* decoded_line(const unsigned char* Psrc, unsigned int src_pitch, unsigned int src_y);
+    void resample_y_line(const unsigned char* Psrc, unsigned int src_pitch, unsigned int dst_y);
+    template< unsigned int CHANNELS > void resample_x_line(unsigned char* Pdst);
+    void resample_x_line_n(unsigned char* Pdst);
+    void resample_x_line_rgb(bool first_line);
+
+    struct Batch_Part;
+    static void resample_batch_part(Batch_Part* Ppart);
+    static void make_tensor_tables(const Tensor_Format& format, unsigned int num_channels, std::vector< float >& tables);
+    template< typename T > void write_chw(const unsigned char* Psrc, unsigned int src_pitch, T* Pdst, const Tensor_Format& format,
+                                          unsigned int x, unsigned int y, const T* Ptables);
+    bool fits(const Tensor_Format& format, unsigned int x, unsigned int y) const;
+
+    Resampler::Status m_status;
+
+    unsigned int m_src_w, m_src_h;
+    unsigned int m_dst_w, m_dst_h;
+    unsigned int m_num_channels;
+    int m_alpha_channel;
+
+    Int_Clists m_clists_x;      // pixels are sample offsets (times num_channels)
+    Int_Clists m_clists_y;      // pixels are source lines
+    unsigned int m_src_x_beg, m_src_x_end;  // in samples, the part of each line the X lists use
+
+    // Tables, index 0 is for color channels, 1 for the alpha channel.
+    std::vector< short > m_decode[ 2 ];
+    std::vector< unsigned char > m_encode[ 2 ];
+
+    // Decoded source lines, line y is in slot y % m_num_slots.
+    std::vector< short > m_slots;
+    std::vector< int > m_slot_line;
+    unsigned int m_num_slots;
+
+    std::vector< short > m_tmp;
+    std::vector< const short* > m_Plines;
+
+    // resample_image_yuv420(): the encoded R', G' and B' rows of the current destination line, the
+    // sums of each 2x2 block of the current pair of lines, and the Cb/Cr rows for NV12.
+    std::vector< short > m_rgb;
+    std::vector< short > m_rgb_sums;
+    std::vector< unsigned char > m_uv;
+
+    // resample_image_chw(): the encoded destination line, before it's split into the planes.
+    std::vector< unsigned char > m_row;
+};
+
+// Resizes 8-bit Y'CbCr 4:2:0 video frames: a w by h Y' plane, and (w + 1) / 2 by (h + 1) / 2 Cb and Cr
+// planes (or one plane of interleaved Cb/Cr pairs, NV12). Each plane goes through a Resampler_U8 on its
+// coded values. The chroma tables are offset so the chroma samples stay where the siting puts them
+// relative to the luma samples, in the source and in the destination. The tables are built once, then
+// resample_frame() is called for every frame of the stream.
+class Resampler_Yuv420
+{
+public:
+    enum Chroma_Siting
+    {
+        CHROMA_CENTER,          // between the luma samples on both axes (JPEG, MPEG-1)
+        CHROMA_LEFT,            // on the even luma columns, between the lines (MPEG-2, H.264 and HEVC default)
+        CHROMA_TOP_LEFT         // on the even luma columns and lines (BT.2020 type 2)
+    };
+
+    // nv12 - The chroma is one plane of interleaved Cb/Cr pairs
+    // parallel - Resample the chroma planes on worker threads, started here and kept for every frame
+    //            (when built with threads)
+    // See Resampler for the rest.
+    Resampler_Yuv420
+        (
+        unsigned int src_w, unsigned int src_h,
+        unsigned int dst_w, unsigned int dst_h,
+        bool nv12 = false,
+        Chroma_Siting siting = CHROMA_LEFT,
+        Resampler::Boundary_Op boundary_op = Resampler::BOUNDARY_CLAMP,
+        const char* Pfilter_name = RESAMPLER_DEFAULT_FILTER,
+        Resample_Real filter_x_scale = 1.0f,
+        Resample_Real filter_y_scale = 1.0f,
+        bool parallel = true
+        );
+
+    ~Resampler_Yuv420();
+
+    Resampler::Status status() const { return m_status; }
+
+    // Switches to a new stream geometry, e.g. after a resolution change, keeping the filter settings and
+    // the worker threads. The tables are only built again if something changed. Returns status().
+    Resampler::Status reset(unsigned int src_w, unsigned int src_h, unsigned int dst_w, unsigned int dst_h,
+                            bool nv12, Chroma_Siting siting);
+
+    // Resamples one frame. Pitches are in bytes, the V plane pointers are ignored with nv12.
+    // false if status() isn't STATUS_OKAY.
+    bool resample_frame(const unsigned char* Psrc_y, unsigned int src_y_pitch,
+                        const unsigned char* Psrc_u, unsigned int src_u_pitch,
+                        const unsigned char* Psrc_v, unsigned int src_v_pitch,
+                        unsigned char* Pdst_y, unsigned int dst_y_pitch,
+                        unsigned char* Pdst_u, unsigned int dst_u_pitch,
+                        unsigned char* Pdst_v, unsigned int dst_v_pitch);
+
+    // The src_ofs of a chroma axis: where the destination chroma samples are in the source chroma plane,
+    // measured at the middle of the plane (the chroma planes are rounded up, so their ratio can differ
+    // a little from the luma ratio). cosited is true if the chroma samples are on the even luma samples.
+    static Resample_Real chroma_offset(unsigned int src_luma, unsigned int dst_luma, bool cosited);
+
+private:
+    Resampler_Yuv420(const Resampler_Yuv420& o);
+    Resampler_Yuv420& operator= (const Resampler_Yuv420& o);
+
+    struct Plane_Job;
+    static void resample_plane(Plane_Job* Pjob);
+
+    // The chroma planes' worker threads, NULL if not parallel.
+    struct Workers;
+    Workers* m_Pworkers;
+    static void worker_thread(Workers* Pworkers, unsigned int job);
+
+    void init(unsigned int src_w, unsigned int src_h, unsigned int dst_w, unsigned int dst_h, bool nv12, Chroma_Siting siting);
+
+    Resampler::Status m_status;
+
+    unsigned int m_src_w, m_src_h;
+    unsigned int m_dst_w, m_dst_h;
+    bool m_nv12;
+    Chroma_Siting m_siting;
+    Resampler::Boundary_Op m_boundary_op;
+    const char* m_Pfilter_name;     // from Resampler::resolve_filter(), so it stays valid
+    Resample_Real m_filter_x_scale, m_filter_y_scale;
+
+    std::auto_ptr< Resampler_U8 > m_Py;
+    std::auto_ptr< Resampler_U8 > m_Pu;     // Cb, or the Cb/Cr pairs with nv12
+    std::auto_ptr< Resampler_U8 > m_Pv;     // a copy of m_Pu, NULL with nv12
+};
+
+// Several crops (destination subrects) of one resized image, e.g. random crops of the same resize. One
+// Resampler per crop would resample the same source lines on the X axis once per crop. Here each
+// source line is resampled once, on the destination columns some crop covers, and the Y axis of every
+// crop is summed from these shared lines. A shared line is released as soon as the last crop using it
+// has generated its lines. Sample values, boundary_op, filter and offsets are the same as Resampler's.
+class Resampler_Crops
+{
+public:
+    typedef Resample_Real Sample;
+
+    // A rectangle of the dst_w by dst_h destination. Like Resampler's subrect, an empty or out of bounds
+    // crop is the whole destination.
+    struct Crop
+    {
+        unsigned int x, y, w, h;
+    };
+
+    Resampler_Crops
+        (
+        unsigned int src_w, unsigned int src_h,
+        unsigned int dst_w, unsigned int dst_h,
+        const Crop* Pcrops, unsigned int num_crops,
+        Resampler::Boundary_Op boundary_op = Resampler::BOUNDARY_CLAMP,
+        Resample_Real sample_low = 0.0f,
+        Resample_Real sample_high = 0.0f,
+        const char* Pfilter_name = RESAMPLER_DEFAULT_FILTER,
+        Resample_Real filter_x_scale = 1.0f,
+        Resample_Real filter_y_scale = 1.0f,
+        Resample_Real src_x_ofs = 0.0f,
+        Resample_Real src_y_ofs = 0.0f
+        );
+
+    Resampler::Status status() const { return m_status; }
+
+    unsigned int get_num_crops() const { return ( unsigned int ) m_crops.size(); }
+    const Crop& get_crop(unsigned int crop) const { return m_crops[ crop ].rect; }
+
+    // Supplies the next source line. false if all the source lines are already in, or if status()
+    // isn't STATUS_OKAY.
+    bool put_line(const Sample* Psrc);
+
+    // The next line of a crop (get_crop( crop ).w samples), NULL if it isn't available yet or the
+    // crop is done. It stays valid until the next get_line() of that crop.
+    const Sample* get_line(unsigned int crop);
+
+    // Resamples a whole image in one call. Psrc holds src_h lines spaced src_pitch samples apart,
+    // crop k's lines go to Pdst[ k ], spaced dst_pitch[ k ] samples apart. false if status() isn't
+    // STATUS_OKAY, if put_line() was already called, or if a line isn't taken.
+    bool resample_image(const Sample* Psrc, unsigned int src_pitch, Sample* const* Pdst, const unsigned int* dst_pitch);
+
+    // The most shared lines held at once so far.
+    unsigned int get_max_lines() const { return m_max_lines; }
+
+private:
+    Resampler_Crops(const Resampler_Crops& o);
+    Resampler_Crops& operator= (const Resampler_Crops& o);
+
+    struct Crop_State
+    {
+        Crop rect;
+        unsigned int next_y;            // next line, relative to rect.y
+        std::vector< Sample > line;
+    };
+
+    struct Column_Span
+    {
+        unsigned int beg, end;          // relative to m_x_beg
+    };
+
+    Resampler::Status m_status;
+    unsigned int m_src_w, m_src_h;
+    Resample_Real m_sample_low, m_sample_high;
+
+    // The contributor lists of the crops' bounding box, which start at m_x_beg and m_y_beg.
+    std::auto_ptr< Resampler::Contrib_List_Container > m_Pclistc_x;
+    std::auto_ptr< Resampler::Contrib_List_Container > m_Pclistc_y;
+    const Resampler::Contrib_List* m_Pclist_x;
+    const Resampler::Contrib_List* m_Pclist_y;
+    unsigned int m_x_beg, m_x_end;
+    unsigned int m_y_beg;
+
+    std::vector< Crop_State > m_crops;
+    std::vector< Column_Span > m_columns;   // the columns some crop covers, in order
+
+    // Shared lines, resampled on the X axis, by source line. m_uses counts the crop lines still
+    // needing each source line.
+    std::vector< unsigned int > m_uses;
+    std::map< int, std::vector< Sample > > m_lines;
+    std::vector< std::vector< Sample > > m_free_lines;
+    unsigned int m_cur_src_y;
+    unsigned int m_max_lines;
+
+    bool line_ready(const Resampler::Contrib_List& clist) const;
+    void release_line(int src_y);
+};
+
 #endif // RESAMPLER_H
 
 // This is free and unencumbered software released into the public domain.
@@ -0,0 +1,272 @@
+// resampler_crops.cpp - Several crops of one resized image sharing the X axis, see Resampler_Crops in resampler.h.
+#include <cassert>
+#include <algorithm>
+#include "resampler.h"
+#include "resampler_simd.h"
+
+static bool crop_less( const Resampler_Crops::Crop& a, const Resampler_Crops::Crop& b )
+{
+    return a.x < b.x;
+}
+
+Resampler_Crops::Resampler_Crops
+    (
+    unsigned int src_w, unsigned int src_h,
+    unsigned int dst_w, unsigned int dst_h,
+    const Crop* Pcrops, unsigned int num_crops,
+    Resampler::Boundary_Op boundary_op,
+    Resample_Real sample_low,
+    Resample_Real sample_high,
+    const char* Pfilter_name,
+    Resample_Real filter_x_scale,
+    Resample_Real filter_y_scale,
+    Resample_Real src_x_ofs,
+    Resample_Real src_y_ofs
+    )
+{
+    m_status = Resampler::STATUS_OKAY;
+    m_src_w = src_w;
+    m_src_h = src_h;
+    m_sample_low = sample_low;
+    m_sample_high = sample_high;
+    m_Pclist_x = NULL;
+    m_Pclist_y = NULL;
+    m_x_beg = m_x_end = m_y_beg = 0;
+    m_cur_src_y = 0;
+    m_max_lines = 0;
+
+    // Same subrect rules as Resampler, and the bounding box of the crops.
+    std::vector< Crop > rects( num_crops );
+    unsigned int y_end = 0;
+    m_x_beg = dst_w;
+    m_y_beg = dst_h;
+    for( unsigned int k = 0; k < num_crops; k++ )
+    {
+        Crop c = Pcrops[ k ];
+        if( !( c.w > 0 && c.h > 0 && c.x + c.w <= dst_w && c.y + c.h <= dst_h ) )
+        {
+            c.x = c.y = 0;
+            c.w = dst_w;
+            c.h = dst_h;
+        }
+        rects[ k ] = c;
+
+        m_x_beg = std::min( m_x_beg, c.x );
+        m_x_end = std::max( m_x_end, c.x + c.w );
+        m_y_beg = std::min( m_y_beg, c.y );
+        y_end = std::max( y_end, c.y + c.h );
+    }
+    if( !num_crops || !dst_w || !dst_h )
+    {
+        // Nothing to generate, the source lines are just counted.
+        m_x_beg = m_x_end = m_y_beg = 0;
+        m_uses.resize( src_h );
+        return;
+    }
+
+    // Only the contributor lists, none of a Resampler's line buffers.
+    m_Pclistc_x = Resampler::make_axis_clist( src_w, dst_w, m_x_beg, m_x_end, boundary_op, Pfilter_name, filter_x_scale, src_x_ofs, m_status );
+    if( m_status != Resampler::STATUS_OKAY )
+        return;
+    m_Pclistc_y = Resampler::make_axis_clist( src_h, dst_h, m_y_beg, y_end, boundary_op, Pfilter_name, filter_y_scale, src_y_ofs, m_status );
+    if( m_status != Resampler::STATUS_OKAY )
+        return;
+
+    m_Pclist_x = &m_Pclistc_x->clists[ 0 ];
+    m_Pclist_y = &m_Pclistc_y->clists[ 0 ];
+
+    m_crops.resize( num_crops );
+    for( unsigned int k = 0; k < num_crops; k++ )
+    {
+        m_crops[ k ].rect = rects[ k ];
+        m_crops[ k ].next_y = 0;
+        m_crops[ k ].line.resize( rects[ k ].w );
+    }
+
+    // The columns covered by some crop, merging the overlapping ones.
+    std::sort( rects.begin(), rects.end(), crop_less );
+    for( unsigned int k = 0; k < num_crops; k++ )
+    {
+        const unsigned int beg = rects[ k ].x - m_x_beg, end = beg + rects[ k ].w;
+        if( !m_columns.empty() && ( beg <= m_columns.back().end ) )
+            m_columns.back().end = std::max( m_columns.back().end, end );
+        else
+        {
+            Column_Span span = { beg, end };
+            m_columns.push_back( span );
+        }
+    }
+
+    // How many crop lines use each source line.
+    m_uses.resize( src_h );
+    for( unsigned int k = 0; k < num_crops; k++ )
+    {
+        const Crop& c = m_crops[ k ].rect;
+        for( unsigned int y = c.y; y < c.y + c.h; y++ )
+        {
+            const Resampler::Contrib_List& clist = m_Pclist_y[ y - m_y_beg ];
+            for( unsigned int j = 0; j < clist.n; j++ )
+                m_uses[ clist.p[ j ].pixel ]++;
+        }
+    }
+}
+
+bool Resampler_Crops::put_line( const Sample* Psrc )
+{
+    if( ( m_status != Resampler::STATUS_OKAY ) || ( m_cur_src_y >= m_src_h ) )
+        return false;
+
+    // Does any crop use this source line?
+    if( !m_uses[ m_cur_src_y ] )
+    {
+        m_cur_src_y++;
+        return true;
+    }
+
+    std::vector< Sample >& line = m_lines[ m_cur_src_y ];
+    if( !m_free_lines.empty() )
+    {
+        line.swap( m_free_lines.back() );
+        m_free_lines.pop_back();
+    }
+    line.resize( m_x_end - m_x_beg );
+
+    if( m_lines.size() > m_max_lines )
+        m_max_lines = ( unsigned int ) m_lines.size();
+
+    // The X axis, once for all the crops.
+    Sample* Pdst = &line[ 0 ];
+    for( unsigned int s = 0; s < m_columns.size(); s++ )
+    {
+        for( unsigned int i = m_columns[ s ].beg; i < m_columns[ s ].end; i++ )
+        {
+            const Resampler::Contrib_List& clist = m_Pclist_x[ i ];
+
+            Sample total = 0;
+            for( unsigned int j = 0; j < clist.n; j++ )
+                total += Psrc[ clist.p[ j ].pixel ] * clist.p[ j ].weight;
+            Pdst[ i ] = total;
+        }
+    }
+
+    m_cur_src_y++;
+    return true;
+}
+
+// Are all the source lines of a Y axis list in?
+bool Resampler_Crops::line_ready( const Resampler::Contrib_List& clist ) const
+{
+    for( unsigned int j = 0; j < clist.n; j++ )
+        if( clist.p[ j ].pixel >= m_cur_src_y )
+            return false;
+    return true;
+}
+
+void Resampler_Crops::release_line( int src_y )
+{
+    std::map< int, std::vector< Sample > >::iterator it = m_lines.find( src_y );
+    assert( it != m_lines.end() );
+
+    m_free_lines.push_back( std::vector< Sample >() );
+    m_free_lines.back().swap( it->second );
+    m_lines.erase( it );
+}
+
+const Resampler_Crops::Sample* Resampler_Crops::get_line( unsigned int crop )
+{
+    if( ( m_status != Resampler::STATUS_OKAY ) || ( crop >= m_crops.size() ) )
+        return NULL;
+
+    Crop_State& state = m_crops[ crop ];
+    if( state.next_y >= state.rect.h )
+        return NULL;
+
+    const Resampler::Contrib_List& clist = m_Pclist_y[ state.rect.y + state.next_y - m_y_beg ];
+    if( !line_ready( clist ) )
+        return NULL;
+
+    const Resampler_Simd_Kernels* Psimd = resampler_simd_kernels();
+    Sample* Pdst = &state.line[ 0 ];
+    const unsigned int ofs = state.rect.x - m_x_beg, n = state.rect.w;
+
+    // The Y axis, from the shared lines.
+    if( !clist.n )
+        std::fill( state.line.begin(), state.line.end(), ( Sample ) 0 );
+    for( unsigned int j = 0; j < clist.n; j++ )
+    {
+        const Sample* Psrc = &m_lines[ clist.p[ j ].pixel ][ ofs ];
+        const Resample_Real weight = clist.p[ j ].weight;
+
+        if( Psimd )
+        {
+            if( j )
+                Psimd->scale_y_add( Pdst, Psrc, weight, n );
+            else
+                Psimd->scale_y_mov( Pdst, Psrc, weight, n );
+        }
+        else if( j )
+        {
+            for( unsigned int i = 0; i < n; i++ )
+                Pdst[ i ] += Psrc[ i ] * weight;
+        }
+        else
+        {
+            for( unsigned int i = 0; i < n; i++ )
+                Pdst[ i ] = Psrc[ i ] * weight;
+        }
+    }
+
+    if( m_sample_low < m_sample_high )
+    {
+        if( Psimd )
+            Psimd->clamp( Pdst, n, m_sample_low, m_sample_high );
+        else
+        {
+            for( unsigned int i = 0; i < n; i++ )
+            {
+                if( Pdst[ i ] < m_sample_low )
+                    Pdst[ i ] = m_sample_low;
+                else if( Pdst[ i ] > m_sample_high )
+                    Pdst[ i ] = m_sample_high;
+            }
+        }
+    }
+
+    // Release the lines no crop needs anymore.
+    for( unsigned int j = 0; j < clist.n; j++ )
+    {
+        const unsigned int src_y = clist.p[ j ].pixel;
+        assert( m_uses[ src_y ] > 0 );
+        if( !--m_uses[ src_y ] )
+            release_line( src_y );
+    }
+
+    state.next_y++;
+    return Pdst;
+}
+
+bool Resampler_Crops::resample_image( const Sample* Psrc, unsigned int src_pitch, Sample* const* Pdst, const unsigned int* dst_pitch )
+{
+    if( ( m_status != Resampler::STATUS_OKAY ) || m_cur_src_y )
+        return false;
+
+    std::vector< unsigned int > dst_y( m_crops.size(), 0 );
+    for( unsigned int y = 0; y < m_src_h; y++ )
+    {
+        if( !put_line( Psrc + ( size_t ) y * src_pitch ) )
+            return false;
+
+        // Generate what's ready right away, so the shared lines are released early.
+        for( unsigned int k = 0; k < m_crops.size(); k++ )
+        {
+            const Sample* Pline;
+            while( ( Pline = get_line( k ) ) != NULL )
+            {
+                std::copy( Pline, Pline + m_crops[ k ].rect.w, Pdst[ k ] + ( size_t ) dst_y[ k ] * dst_pitch[ k ] );
+                dst_y[ k ]++;
+            }
+        }
+    }
+
+    return true;
+}
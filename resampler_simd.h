@@ -0,0 +1,53 @@
+// resampler_simd.h - Vector versions of the resampler's inner loops, see resampler_simd.inl.
+// Internal to the resampler, the scalar code in resampler.cpp is the reference implementation.
+#ifndef RESAMPLER_SIMD_H
+#define RESAMPLER_SIMD_H
+
+#include "resampler.h"
+
+// The kernels work on floats.
+typedef char Resampler_Simd_Float_Check[ ( sizeof( Resample_Real ) == sizeof( float ) ) ? 1 : -1 ];
+
+// Resampler::BLOCK_ROWS, which resample_x_block() checks.
+enum { RESAMPLER_SIMD_BLOCK_ROWS = 8 };
+
+// Resampler_U8::WEIGHT_BITS, the fixed point weights of vert_i16() and rgb_to_yuv().
+enum { RESAMPLER_SIMD_WEIGHT_BITS = 14 };
+
+// The constant term of rgb_to_yuv() is its last coefficient times this.
+enum { RESAMPLER_SIMD_YUV_ONE = 1024 };
+
+struct Resampler_Simd_Kernels
+{
+    const char* Pname;
+
+    // Same as Resampler::scale_y_mov(), scale_y_add(), scale_y_add_lines() and clamp().
+    void ( *scale_y_mov )( Resample_Real* Ptmp, const Resample_Real* Psrc, Resample_Real weight, unsigned int n );
+    void ( *scale_y_add )( Resample_Real* Ptmp, const Resample_Real* Psrc, Resample_Real weight, unsigned int n );
+    void ( *scale_y_add_lines )( Resample_Real* const* Ptmp, const Resample_Real* weights, unsigned int num, const Resample_Real* Psrc, unsigned int n );
+    void ( *clamp )( Resample_Real* Pdst, unsigned int n, Resample_Real lo, Resample_Real hi );
+
+    // The contributor loop of Resampler::resample_x_block(): sums the RESAMPLER_SIMD_BLOCK_ROWS
+    // samples of the tile columns of n contributors into Ptotal. Ptile starts at source column tile_beg.
+    void ( *block_x )( Resample_Real* Ptotal, const Resample_Real* Ptile, unsigned int tile_beg, const Resampler::Contrib* Pcontribs, unsigned int n );
+
+    // Resampler_U8's Y axis: Pdst[ i ] = sum of weights[ k ] * Psrc[ k ][ i ] over num lines,
+    // rounded to RESAMPLER_SIMD_WEIGHT_BITS fewer bits and saturated to 16 bits.
+    void ( *vert_i16 )( short* Pdst, const short* const* Psrc, const short* weights, unsigned int num, unsigned int n );
+
+    // One row of Resampler_U8's R'G'B' to Y'CbCr matrix: Pdst[ i ] = c[ 0 ] * Pr[ i ] + c[ 1 ] * Pg[ i ] +
+    // c[ 2 ] * Pb[ i ] + c[ 3 ] * RESAMPLER_SIMD_YUV_ONE, rounded to RESAMPLER_SIMD_WEIGHT_BITS fewer
+    // bits and saturated to 0..255.
+    void ( *rgb_to_yuv )( unsigned char* Pdst, const short* Pr, const short* Pg, const short* Pb, const short* c, unsigned int n );
+};
+
+// Each target is built in its own translation unit with its own compiler flags. NULL if the
+// target wasn't compiled in, the caller checks that the CPU supports it.
+const Resampler_Simd_Kernels* resampler_simd_sse41();
+const Resampler_Simd_Kernels* resampler_simd_avx2();
+const Resampler_Simd_Kernels* resampler_simd_neon();
+
+// The kernels in use, see Resampler::get_simd_target(). NULL for the scalar code.
+const Resampler_Simd_Kernels* resampler_simd_kernels();
+
+#endif // RESAMPLER_SIMD_H
@@ -0,0 +1,185 @@
+// resampler_simd.inl - The SIMD kernels, written once against a small vector wrapper.
+// Included by each target's translation unit, which first defines:
+//   Vec, VEC_WIDTH                  - a vector of VEC_WIDTH floats
+//   vec_load( p ), vec_store( p, a ) - unaligned load/store
+//   vec_set1( f )                   - f in every lane
+//   vec_mul( a, b ), vec_min( a, b ), vec_max( a, b )
+//   vec_madd( a, b, c )             - a + b * c (fused where the target has it)
+// vec_min/vec_max must pass a NaN second operand through, like the scalar clamp.
+// The 16-bit integer kernels use:
+//   IVec, IVEC_WIDTH                - a vector of IVEC_WIDTH shorts
+//   ivec_load( p ), ivec_store( p, a ), ivec_zero()
+//   IWeights, ivec_weights( w0, w1 ) - a pair of weights
+//   IAcc, iacc_zero()               - IVEC_WIDTH 32-bit sums
+//   iacc_madd2( acc, a, b, w )      - acc += a * w0 + b * w1
+//   iacc_pack( acc )                - ( acc + round ) >> RESAMPLER_SIMD_WEIGHT_BITS, saturated to shorts
+//   ivec_set1( s )                  - s in every lane
+//   ivec_store_u8( p, a )           - stores IVEC_WIDTH bytes, saturated to 0..255
+// VEC_NAME is the target's name.
+
+static void simd_scale_y_mov( Resample_Real* Ptmp, const Resample_Real* Psrc, Resample_Real weight, unsigned int n )
+{
+    const Vec w = vec_set1( weight );
+
+    unsigned int i = 0;
+    for( ; i + VEC_WIDTH <= n; i += VEC_WIDTH )
+        vec_store( Ptmp + i, vec_mul( vec_load( Psrc + i ), w ) );
+
+    for( ; i < n; i++ )
+        Ptmp[ i ] = Psrc[ i ] * weight;
+}
+
+static void simd_scale_y_add( Resample_Real* Ptmp, const Resample_Real* Psrc, Resample_Real weight, unsigned int n )
+{
+    const Vec w = vec_set1( weight );
+
+    unsigned int i = 0;
+    for( ; i + VEC_WIDTH <= n; i += VEC_WIDTH )
+        vec_store( Ptmp + i, vec_madd( vec_load( Ptmp + i ), vec_load( Psrc + i ), w ) );
+
+    for( ; i < n; i++ )
+        Ptmp[ i ] += Psrc[ i ] * weight;
+}
+
+// Each source vector is loaded once and added to NUM destination lines.
+template< unsigned int NUM >
+static void simd_scale_y_add_num( Resample_Real* const* Ptmp, const Resample_Real* weights, const Resample_Real* Psrc, unsigned int n )
+{
+    Vec w[ NUM ];
+    for( unsigned int j = 0; j < NUM; j++ )
+        w[ j ] = vec_set1( weights[ j ] );
+
+    unsigned int i = 0;
+    for( ; i + VEC_WIDTH <= n; i += VEC_WIDTH )
+    {
+        const Vec s = vec_load( Psrc + i );
+        for( unsigned int j = 0; j < NUM; j++ )
+            vec_store( Ptmp[ j ] + i, vec_madd( vec_load( Ptmp[ j ] + i ), s, w[ j ] ) );
+    }
+
+    for( ; i < n; i++ )
+    {
+        const Resample_Real s = Psrc[ i ];
+        for( unsigned int j = 0; j < NUM; j++ )
+            Ptmp[ j ][ i ] += s * weights[ j ];
+    }
+}
+
+static void simd_scale_y_add_lines( Resample_Real* const* Ptmp, const Resample_Real* weights, unsigned int num, const Resample_Real* Psrc, unsigned int n )
+{
+    switch( num )
+    {
+        case 4: simd_scale_y_add_num< 4 >( Ptmp, weights, Psrc, n ); break;
+        case 3: simd_scale_y_add_num< 3 >( Ptmp, weights, Psrc, n ); break;
+        case 2: simd_scale_y_add_num< 2 >( Ptmp, weights, Psrc, n ); break;
+        default:
+        {
+            for( unsigned int j = 0; j < num; j++ )
+                simd_scale_y_add( Ptmp[ j ], Psrc, weights[ j ], n );
+            break;
+        }
+    }
+}
+
+static void simd_clamp( Resample_Real* Pdst, unsigned int n, Resample_Real lo, Resample_Real hi )
+{
+    const Vec vlo = vec_set1( lo ), vhi = vec_set1( hi );
+
+    unsigned int i = 0;
+    for( ; i + VEC_WIDTH <= n; i += VEC_WIDTH )
+        vec_store( Pdst + i, vec_min( vhi, vec_max( vlo, vec_load( Pdst + i ) ) ) );
+
+    for( ; i < n; i++ )
+    {
+        if( Pdst[ i ] < lo )
+            Pdst[ i ] = lo;
+        else if( Pdst[ i ] > hi )
+            Pdst[ i ] = hi;
+    }
+}
+
+static void simd_block_x( Resample_Real* Ptotal, const Resample_Real* Ptile, unsigned int tile_beg, const Resampler::Contrib* Pcontribs, unsigned int n )
+{
+    enum { NUM_VECS = RESAMPLER_SIMD_BLOCK_ROWS / VEC_WIDTH };
+
+    Vec total[ NUM_VECS ];
+    for( unsigned int v = 0; v < NUM_VECS; v++ )
+        total[ v ] = vec_set1( 0.0f );
+
+    for( unsigned int j = 0; j < n; j++ )
+    {
+        const Resample_Real* Pcol = Ptile + ( Pcontribs[ j ].pixel - tile_beg ) * RESAMPLER_SIMD_BLOCK_ROWS;
+        const Vec w = vec_set1( Pcontribs[ j ].weight );
+        for( unsigned int v = 0; v < NUM_VECS; v++ )
+            total[ v ] = vec_madd( total[ v ], vec_load( Pcol + v * VEC_WIDTH ), w );
+    }
+
+    for( unsigned int v = 0; v < NUM_VECS; v++ )
+        vec_store( Ptotal + v * VEC_WIDTH, total[ v ] );
+}
+
+static void simd_vert_i16( short* Pdst, const short* const* Psrc, const short* weights, unsigned int num, unsigned int n )
+{
+    unsigned int i = 0;
+    for( ; i + IVEC_WIDTH <= n; i += IVEC_WIDTH )
+    {
+        IAcc acc = iacc_zero();
+
+        unsigned int k = 0;
+        for( ; k + 2 <= num; k += 2 )
+            iacc_madd2( acc, ivec_load( Psrc[ k ] + i ), ivec_load( Psrc[ k + 1 ] + i ), ivec_weights( weights[ k ], weights[ k + 1 ] ) );
+        if( k < num )
+            iacc_madd2( acc, ivec_load( Psrc[ k ] + i ), ivec_zero(), ivec_weights( weights[ k ], 0 ) );
+
+        ivec_store( Pdst + i, iacc_pack( acc ) );
+    }
+
+    for( ; i < n; i++ )
+    {
+        int total = 1 << ( RESAMPLER_SIMD_WEIGHT_BITS - 1 );
+        for( unsigned int k = 0; k < num; k++ )
+            total += weights[ k ] * Psrc[ k ][ i ];
+
+        total >>= RESAMPLER_SIMD_WEIGHT_BITS;
+        if( total < -32768 )
+            total = -32768;
+        else if( total > 32767 )
+            total = 32767;
+        Pdst[ i ] = ( short ) total;
+    }
+}
+
+static void simd_rgb_to_yuv( unsigned char* Pdst, const short* Pr, const short* Pg, const short* Pb, const short* c, unsigned int n )
+{
+    const IWeights rg = ivec_weights( c[ 0 ], c[ 1 ] ), b1 = ivec_weights( c[ 2 ], c[ 3 ] );
+    const IVec one = ivec_set1( RESAMPLER_SIMD_YUV_ONE );
+
+    unsigned int i = 0;
+    for( ; i + IVEC_WIDTH <= n; i += IVEC_WIDTH )
+    {
+        IAcc acc = iacc_zero();
+        iacc_madd2( acc, ivec_load( Pr + i ), ivec_load( Pg + i ), rg );
+        iacc_madd2( acc, ivec_load( Pb + i ), one, b1 );
+        ivec_store_u8( Pdst + i, iacc_pack( acc ) );
+    }
+
+    for( ; i < n; i++ )
+    {
+        int v = ( c[ 0 ] * Pr[ i ] + c[ 1 ] * Pg[ i ] + c[ 2 ] * Pb[ i ] + c[ 3 ] * RESAMPLER_SIMD_YUV_ONE +
+                  ( 1 << ( RESAMPLER_SIMD_WEIGHT_BITS - 1 ) ) ) >> RESAMPLER_SIMD_WEIGHT_BITS;
+        if( v < 0 ) v = 0; else if( v > 255 ) v = 255;
+        Pdst[ i ] = ( unsigned char ) v;
+    }
+}
+
+static const Resampler_Simd_Kernels g_simd_kernels =
+{
+    VEC_NAME,
+    simd_scale_y_mov,
+    simd_scale_y_add,
+    simd_scale_y_add_lines,
+    simd_clamp,
+    simd_block_x,
+    simd_vert_i16,
+    simd_rgb_to_yuv
+};
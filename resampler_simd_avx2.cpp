@@ -0,0 +1,68 @@
+// resampler_simd_avx2.cpp - AVX2+FMA build of the SIMD kernels, compiled with -mavx2 -mfma (/arch:AVX2).
+// Fused multiply-adds round differently from the scalar code, by at most an ulp per tap.
+#include "resampler_simd.h"
+
+#if defined( __AVX2__ ) && ( defined( __FMA__ ) || defined( _MSC_VER ) )
+#include <immintrin.h>
+
+#define VEC_NAME "avx2"
+
+typedef __m256 Vec;
+enum { VEC_WIDTH = 8 };
+
+static inline Vec vec_load( const float* p ) { return _mm256_loadu_ps( p ); }
+static inline void vec_store( float* p, Vec a ) { _mm256_storeu_ps( p, a ); }
+static inline Vec vec_set1( float f ) { return _mm256_set1_ps( f ); }
+static inline Vec vec_mul( Vec a, Vec b ) { return _mm256_mul_ps( a, b ); }
+static inline Vec vec_madd( Vec a, Vec b, Vec c ) { return _mm256_fmadd_ps( b, c, a ); }
+static inline Vec vec_min( Vec a, Vec b ) { return _mm256_min_ps( a, b ); }
+static inline Vec vec_max( Vec a, Vec b ) { return _mm256_max_ps( a, b ); }
+
+// 16 shorts per register. The unpacks and packs work within 128-bit halves, so the lanes
+// come back out in order.
+typedef __m256i IVec;
+typedef __m256i IWeights;
+struct IAcc { __m256i lo, hi; };
+enum { IVEC_WIDTH = 16 };
+
+static inline IVec ivec_load( const short* p ) { return _mm256_loadu_si256( ( const __m256i* ) p ); }
+static inline void ivec_store( short* p, IVec a ) { _mm256_storeu_si256( ( __m256i* ) p, a ); }
+static inline IVec ivec_zero() { return _mm256_setzero_si256(); }
+static inline IVec ivec_set1( short s ) { return _mm256_set1_epi16( s ); }
+
+// The pack works within 128-bit halves, the permute gathers the two low quadwords.
+static inline void ivec_store_u8( unsigned char* p, IVec a )
+{
+    _mm_storeu_si128( ( __m128i* ) p, _mm256_castsi256_si128( _mm256_permute4x64_epi64( _mm256_packus_epi16( a, a ), 0x08 ) ) );
+}
+static inline IWeights ivec_weights( short w0, short w1 ) { return _mm256_set1_epi32( ( int ) ( ( ( unsigned int ) ( unsigned short ) w1 << 16 ) | ( unsigned short ) w0 ) ); }
+static inline IAcc iacc_zero() { IAcc acc = { _mm256_setzero_si256(), _mm256_setzero_si256() }; return acc; }
+
+static inline void iacc_madd2( IAcc& acc, IVec a, IVec b, IWeights w )
+{
+    acc.lo = _mm256_add_epi32( acc.lo, _mm256_madd_epi16( _mm256_unpacklo_epi16( a, b ), w ) );
+    acc.hi = _mm256_add_epi32( acc.hi, _mm256_madd_epi16( _mm256_unpackhi_epi16( a, b ), w ) );
+}
+
+static inline IVec iacc_pack( const IAcc& acc )
+{
+    const __m256i round = _mm256_set1_epi32( 1 << ( RESAMPLER_SIMD_WEIGHT_BITS - 1 ) );
+    return _mm256_packs_epi32( _mm256_srai_epi32( _mm256_add_epi32( acc.lo, round ), RESAMPLER_SIMD_WEIGHT_BITS ),
+                               _mm256_srai_epi32( _mm256_add_epi32( acc.hi, round ), RESAMPLER_SIMD_WEIGHT_BITS ) );
+}
+
+#include "resampler_simd.inl"
+
+const Resampler_Simd_Kernels* resampler_simd_avx2()
+{
+    return &g_simd_kernels;
+}
+
+#else
+
+const Resampler_Simd_Kernels* resampler_simd_avx2()
+{
+    return NULL;
+}
+
+#endif
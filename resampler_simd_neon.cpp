@@ -0,0 +1,64 @@
+// resampler_simd_neon.cpp - NEON build of the SIMD kernels (always on AArch64, -mfpu=neon on 32-bit ARM).
+#include "resampler_simd.h"
+
+#if defined( __ARM_NEON ) || defined( __ARM_NEON__ ) || defined( _M_ARM64 )
+#include <arm_neon.h>
+
+#define VEC_NAME "neon"
+
+typedef float32x4_t Vec;
+enum { VEC_WIDTH = 4 };
+
+static inline Vec vec_load( const float* p ) { return vld1q_f32( p ); }
+static inline void vec_store( float* p, Vec a ) { vst1q_f32( p, a ); }
+static inline Vec vec_set1( float f ) { return vdupq_n_f32( f ); }
+static inline Vec vec_mul( Vec a, Vec b ) { return vmulq_f32( a, b ); }
+
+// vmlaq_f32 isn't fused, so the sums match the scalar code.
+static inline Vec vec_madd( Vec a, Vec b, Vec c ) { return vmlaq_f32( a, b, c ); }
+
+// vminq/vmaxq propagate NaNs, like the scalar clamp.
+static inline Vec vec_min( Vec a, Vec b ) { return vminq_f32( a, b ); }
+static inline Vec vec_max( Vec a, Vec b ) { return vmaxq_f32( a, b ); }
+
+typedef int16x8_t IVec;
+struct IWeights { short w0, w1; };
+struct IAcc { int32x4_t lo, hi; };
+enum { IVEC_WIDTH = 8 };
+
+static inline IVec ivec_load( const short* p ) { return vld1q_s16( p ); }
+static inline void ivec_store( short* p, IVec a ) { vst1q_s16( p, a ); }
+static inline IVec ivec_zero() { return vdupq_n_s16( 0 ); }
+static inline IVec ivec_set1( short s ) { return vdupq_n_s16( s ); }
+static inline void ivec_store_u8( unsigned char* p, IVec a ) { vst1_u8( p, vqmovun_s16( a ) ); }
+static inline IWeights ivec_weights( short w0, short w1 ) { IWeights w = { w0, w1 }; return w; }
+static inline IAcc iacc_zero() { IAcc acc = { vdupq_n_s32( 0 ), vdupq_n_s32( 0 ) }; return acc; }
+
+static inline void iacc_madd2( IAcc& acc, IVec a, IVec b, IWeights w )
+{
+    acc.lo = vmlal_n_s16( vmlal_n_s16( acc.lo, vget_low_s16( a ), w.w0 ), vget_low_s16( b ), w.w1 );
+    acc.hi = vmlal_n_s16( vmlal_n_s16( acc.hi, vget_high_s16( a ), w.w0 ), vget_high_s16( b ), w.w1 );
+}
+
+static inline IVec iacc_pack( const IAcc& acc )
+{
+    const int32x4_t round = vdupq_n_s32( 1 << ( RESAMPLER_SIMD_WEIGHT_BITS - 1 ) );
+    return vcombine_s16( vqmovn_s32( vshrq_n_s32( vaddq_s32( acc.lo, round ), RESAMPLER_SIMD_WEIGHT_BITS ) ),
+                         vqmovn_s32( vshrq_n_s32( vaddq_s32( acc.hi, round ), RESAMPLER_SIMD_WEIGHT_BITS ) ) );
+}
+
+#include "resampler_simd.inl"
+
+const Resampler_Simd_Kernels* resampler_simd_neon()
+{
+    return &g_simd_kernels;
+}
+
+#else
+
+const Resampler_Simd_Kernels* resampler_simd_neon()
+{
+    return NULL;
+}
+
+#endif
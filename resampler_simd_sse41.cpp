@@ -0,0 +1,61 @@
+// resampler_simd_sse41.cpp - SSE4.1 build of the SIMD kernels, compiled with -msse4.1.
+#include "resampler_simd.h"
+
+#if defined( __SSE4_1__ ) || ( defined( _MSC_VER ) && ( _MSC_VER >= 1500 ) && ( defined( _M_IX86 ) || defined( _M_X64 ) ) )
+#include <smmintrin.h>
+
+#define VEC_NAME "sse4.1"
+
+typedef __m128 Vec;
+enum { VEC_WIDTH = 4 };
+
+static inline Vec vec_load( const float* p ) { return _mm_loadu_ps( p ); }
+static inline void vec_store( float* p, Vec a ) { _mm_storeu_ps( p, a ); }
+static inline Vec vec_set1( float f ) { return _mm_set1_ps( f ); }
+static inline Vec vec_mul( Vec a, Vec b ) { return _mm_mul_ps( a, b ); }
+static inline Vec vec_madd( Vec a, Vec b, Vec c ) { return _mm_add_ps( a, _mm_mul_ps( b, c ) ); }
+static inline Vec vec_min( Vec a, Vec b ) { return _mm_min_ps( a, b ); }
+static inline Vec vec_max( Vec a, Vec b ) { return _mm_max_ps( a, b ); }
+
+typedef __m128i IVec;
+typedef __m128i IWeights;
+struct IAcc { __m128i lo, hi; };
+enum { IVEC_WIDTH = 8 };
+
+static inline IVec ivec_load( const short* p ) { return _mm_loadu_si128( ( const __m128i* ) p ); }
+static inline void ivec_store( short* p, IVec a ) { _mm_storeu_si128( ( __m128i* ) p, a ); }
+static inline IVec ivec_zero() { return _mm_setzero_si128(); }
+static inline IVec ivec_set1( short s ) { return _mm_set1_epi16( s ); }
+static inline void ivec_store_u8( unsigned char* p, IVec a ) { _mm_storel_epi64( ( __m128i* ) p, _mm_packus_epi16( a, a ) ); }
+static inline IWeights ivec_weights( short w0, short w1 ) { return _mm_set1_epi32( ( int ) ( ( ( unsigned int ) ( unsigned short ) w1 << 16 ) | ( unsigned short ) w0 ) ); }
+static inline IAcc iacc_zero() { IAcc acc = { _mm_setzero_si128(), _mm_setzero_si128() }; return acc; }
+
+// Interleaving the two lines turns the products and their sum into one pmaddwd.
+static inline void iacc_madd2( IAcc& acc, IVec a, IVec b, IWeights w )
+{
+    acc.lo = _mm_add_epi32( acc.lo, _mm_madd_epi16( _mm_unpacklo_epi16( a, b ), w ) );
+    acc.hi = _mm_add_epi32( acc.hi, _mm_madd_epi16( _mm_unpackhi_epi16( a, b ), w ) );
+}
+
+static inline IVec iacc_pack( const IAcc& acc )
+{
+    const __m128i round = _mm_set1_epi32( 1 << ( RESAMPLER_SIMD_WEIGHT_BITS - 1 ) );
+    return _mm_packs_epi32( _mm_srai_epi32( _mm_add_epi32( acc.lo, round ), RESAMPLER_SIMD_WEIGHT_BITS ),
+                            _mm_srai_epi32( _mm_add_epi32( acc.hi, round ), RESAMPLER_SIMD_WEIGHT_BITS ) );
+}
+
+#include "resampler_simd.inl"
+
+const Resampler_Simd_Kernels* resampler_simd_sse41()
+{
+    return &g_simd_kernels;
+}
+
+#else
+
+const Resampler_Simd_Kernels* resampler_simd_sse41()
+{
+    return NULL;
+}
+
+#endif
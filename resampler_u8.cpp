@@ -0,0 +1,749 @@
+// resampler_u8.cpp - Gamma correct 8-bit resampling on 16-bit integers, see Resampler_U8 in resampler.h.
+#include <cmath>
+#include <cassert>
+#include <cstring>
+#include "resampler.h"
+#include "resampler_simd.h"
+
+// resample_batch_chw() splits the images over C++11 threads, like resampler.cpp.
+#if !defined( RESAMPLER_NO_THREADS ) && ( ( __cplusplus >= 201103L ) || ( defined( _MSC_VER ) && ( _MSC_VER >= 1700 ) ) )
+#define RESAMPLER_THREADS 1
+#include <thread>
+#endif
+
+static const int LINEAR_MAX = ( 1 << Resampler_U8::LINEAR_BITS ) - 1;
+static const int WEIGHT_ONE = 1 << Resampler_U8::WEIGHT_BITS;
+
+// Sums num lines of 16-bit samples with fixed point weights. The SIMD kernels do the same.
+static void vert_i16( short* Pdst, const short* const* Psrc, const short* weights, unsigned int num, unsigned int n )
+{
+    for( unsigned int i = 0; i < n; i++ )
+    {
+        int total = WEIGHT_ONE >> 1;
+        for( unsigned int k = 0; k < num; k++ )
+            total += weights[ k ] * Psrc[ k ][ i ];
+
+        total >>= Resampler_U8::WEIGHT_BITS;
+        if( total < -32768 )
+            total = -32768;
+        else if( total > 32767 )
+            total = 32767;
+        Pdst[ i ] = ( short ) total;
+    }
+}
+
+// Same as the rgb_to_yuv SIMD kernel.
+static void rgb_to_yuv( unsigned char* Pdst, const short* Pr, const short* Pg, const short* Pb, const short* c, unsigned int n )
+{
+    for( unsigned int i = 0; i < n; i++ )
+    {
+        int v = ( c[ 0 ] * Pr[ i ] + c[ 1 ] * Pg[ i ] + c[ 2 ] * Pb[ i ] + c[ 3 ] * RESAMPLER_SIMD_YUV_ONE +
+                  ( WEIGHT_ONE >> 1 ) ) >> Resampler_U8::WEIGHT_BITS;
+        if( v < 0 ) v = 0; else if( v > 255 ) v = 255;
+        Pdst[ i ] = ( unsigned char ) v;
+    }
+}
+
+// Y', Cb and Cr rows of each Yuv_Matrix, in WEIGHT_BITS fixed point. The last coefficient times
+// RESAMPLER_SIMD_YUV_ONE is the offset (16 or 128). Y' is computed from 0..255 R'G'B' samples:
+// Y' = 16 + 219 / 255 * ( Kr R' + ( 1 - Kr - Kb ) G' + Kb B' ). Cb and Cr are computed from the sums
+// of 2x2 blocks, so their coefficients are a quarter of 224 / 255 * ( B' - Y ) / ( 2 - 2 Kb ) and
+// 224 / 255 * ( R' - Y ) / ( 2 - 2 Kr ). The coefficients of each chroma row sum to 0, so grays stay neutral.
+static const short g_yuv_coefs[ 2 ][ 3 ][ 4 ] =
+{
+    // BT.601: Kr = 0.299, Kb = 0.114
+    {
+        { 4207, 8260, 1604, 256 },
+        { -607, -1192, 1799, 2048 },
+        { 1799, -1506, -293, 2048 }
+    },
+    // BT.709: Kr = 0.2126, Kb = 0.0722
+    {
+        { 2991, 10064, 1016, 256 },
+        { -412, -1387, 1799, 2048 },
+        { 1799, -1634, -165, 2048 }
+    }
+};
+
+Resampler_U8::Resampler_U8
+    (
+    unsigned int src_w, unsigned int src_h,
+    unsigned int dst_w, unsigned int dst_h,
+    unsigned int num_channels,
+    Resample_Real source_gamma,
+    int alpha_channel,
+    Resampler::Boundary_Op boundary_op,
+    const char* Pfilter_name,
+    Resample_Real filter_x_scale,
+    Resample_Real filter_y_scale,
+    unsigned int dst_subrect_x, unsigned int dst_subrect_y,
+    unsigned int dst_subrect_w, unsigned int dst_subrect_h,
+    Resample_Real src_x_ofs,
+    Resample_Real src_y_ofs
+    )
+{
+    typedef char weight_bits_check[ ( ( int ) WEIGHT_BITS == ( int ) RESAMPLER_SIMD_WEIGHT_BITS ) ? 1 : -1 ];
+    ( void ) sizeof( weight_bits_check );
+
+    assert( num_channels > 0 );
+
+    m_src_w = src_w;
+    m_src_h = src_h;
+    m_num_channels = num_channels;
+    m_alpha_channel = alpha_channel;
+    m_num_slots = 0;
+
+    // Same subrect rules as Resampler.
+    if( dst_subrect_w > 0 && dst_subrect_h > 0 &&
+        dst_subrect_x + dst_subrect_w <= dst_w &&
+        dst_subrect_y + dst_subrect_h <= dst_h )
+    {
+        m_dst_w = dst_subrect_w;
+        m_dst_h = dst_subrect_h;
+    }
+    else
+    {
+        dst_subrect_x = dst_subrect_y = 0;
+        m_dst_w = dst_subrect_w = dst_w;
+        m_dst_h = dst_subrect_h = dst_h;
+    }
+
+    // Only used for its contributor lists.
+    Resampler resampler( src_w, src_h, dst_w, dst_h, boundary_op, 0.0f, 0.0f, Pfilter_name, NULL, NULL,
+                         filter_x_scale, filter_y_scale, src_x_ofs, src_y_ofs, dst_subrect_x, dst_subrect_y, dst_subrect_w, dst_subrect_h );
+    m_status = resampler.status();
+    if( m_status != Resampler::STATUS_OKAY )
+        return;
+
+    make_int_clists( resampler.get_clist_x(), m_dst_w, num_channels, m_clists_x );
+    make_int_clists( resampler.get_clist_y(), m_dst_h, 1, m_clists_y );
+
+    // Only decode and sum the part of the source lines the X lists use, and make the X list
+    // pixels relative to it.
+    m_src_x_beg = src_w * num_channels;
+    m_src_x_end = 0;
+    for( unsigned int j = 0; j < m_clists_x.pixel.size(); j++ )
+    {
+        if( m_clists_x.pixel[ j ] < m_src_x_beg )
+            m_src_x_beg = m_clists_x.pixel[ j ];
+        if( m_clists_x.pixel[ j ] + num_channels > m_src_x_end )
+            m_src_x_end = m_clists_x.pixel[ j ] + num_channels;
+    }
+    for( unsigned int j = 0; j < m_clists_x.pixel.size(); j++ )
+        m_clists_x.pixel[ j ] -= m_src_x_beg;
+
+    // Enough slots for the lines of any Y list to be decoded at the same time.
+    unsigned int max_num = 0;
+    for( unsigned int i = 0; i < m_dst_h; i++ )
+    {
+        const unsigned int beg = m_clists_y.beg[ i ], end = m_clists_y.beg[ i + 1 ];
+        unsigned int lo = m_clists_y.pixel[ beg ], hi = lo;
+        for( unsigned int j = beg + 1; j < end; j++ )
+        {
+            if( m_clists_y.pixel[ j ] < lo )
+                lo = m_clists_y.pixel[ j ];
+            if( m_clists_y.pixel[ j ] > hi )
+                hi = m_clists_y.pixel[ j ];
+        }
+        if( hi - lo + 1 > m_num_slots )
+            m_num_slots = hi - lo + 1;
+        if( end - beg > max_num )
+            max_num = end - beg;
+    }
+
+    const unsigned int line_size = m_src_x_end - m_src_x_beg;
+    m_slots.resize( m_num_slots * line_size );
+    m_slot_line.resize( m_num_slots, -1 );
+    m_tmp.resize( line_size );
+    m_Plines.resize( max_num );
+
+    // Tables.
+    for( unsigned int k = 0; k < 2; k++ )
+    {
+        const double gamma = k ? 1.0 : source_gamma;
+
+        m_decode[ k ].resize( 256 );
+        for( int i = 0; i < 256; i++ )
+            m_decode[ k ][ i ] = ( short ) floor( pow( i / 255.0, gamma ) * LINEAR_MAX + .5 );
+
+        m_encode[ k ].resize( LINEAR_MAX + 1 );
+        for( int i = 0; i <= LINEAR_MAX; i++ )
+        {
+            int c = ( int ) floor( 255.0 * pow( ( double ) i / LINEAR_MAX, 1.0 / gamma ) + .5 );
+            if( c < 0 ) c = 0; else if( c > 255 ) c = 255;
+            m_encode[ k ][ i ] = ( unsigned char ) c;
+        }
+    }
+}
+
+// Converts the weights to fixed point, keeping each list's sum exactly WEIGHT_ONE.
+void Resampler_U8::make_int_clists( const Resampler::Contrib_List* Pclists, unsigned int n, unsigned int pixel_mul, Int_Clists& clists )
+{
+    clists.beg.resize( n + 1 );
+    clists.pixel.clear();
+    clists.weight.clear();
+
+    for( unsigned int i = 0; i < n; i++ )
+    {
+        const Resampler::Contrib_List& clist = Pclists[ i ];
+        clists.beg[ i ] = ( unsigned int ) clists.pixel.size();
+
+        int total = 0;
+        unsigned int max_k = 0;
+        for( unsigned int k = 0; k < clist.n; k++ )
+        {
+            int w = ( int ) floor( clist.p[ k ].weight * WEIGHT_ONE + .5f );
+            if( w < -32768 ) w = -32768; else if( w > 32767 ) w = 32767;
+
+            clists.pixel.push_back( clist.p[ k ].pixel * pixel_mul );
+            clists.weight.push_back( ( short ) w );
+            total += w;
+
+            if( clist.p[ k ].weight > clist.p[ max_k ].weight )
+                max_k = k;
+        }
+
+        if( clist.n )
+            clists.weight[ clists.beg[ i ] + max_k ] = ( short ) ( clists.weight[ clists.beg[ i ] + max_k ] + WEIGHT_ONE - total );
+    }
+
+    clists.beg[ n ] = ( unsigned int ) clists.pixel.size();
+}
+
+// The used part of source line src_y, decoded to linear light.
+const short* Resampler_U8::decoded_line( const unsigned char* Psrc, unsigned int src_pitch, unsigned int src_y )
+{
+    const unsigned int line_size = m_src_x_end - m_src_x_beg;
+    const unsigned int slot = src_y % m_num_slots;
+    short* Pline = &m_slots[ slot * line_size ];
+
+    if( m_slot_line[ slot ] == ( int ) src_y )
+        return Pline;
+    m_slot_line[ slot ] = ( int ) src_y;
+
+    const unsigned char* Ps = Psrc + ( size_t ) src_y * src_pitch + m_src_x_beg;
+    const short* Pcolor = &m_decode[ 0 ][ 0 ];
+    const short* Palpha = &m_decode[ 1 ][ 0 ];
+
+    if( m_alpha_channel < 0 )
+    {
+        for( unsigned int i = 0; i < line_size; i++ )
+            Pline[ i ] = Pcolor[ Ps[ i ] ];
+    }
+    else
+    {
+        // m_src_x_beg is a multiple of the pixel size.
+        unsigned int c = 0;
+        for( unsigned int i = 0; i < line_size; i++ )
+        {
+            Pline[ i ] = ( ( int ) c == m_alpha_channel ) ? Palpha[ Ps[ i ] ] : Pcolor[ Ps[ i ] ];
+            if( ++c == m_num_channels )
+                c = 0;
+        }
+    }
+
+    return Pline;
+}
+
+// Resamples m_tmp on the X axis and encodes the result.
+template< unsigned int CHANNELS >
+void Resampler_U8::resample_x_line( unsigned char* Pdst )
+{
+    const short* Ptmp = &m_tmp[ 0 ];
+    const unsigned int* Pbeg = &m_clists_x.beg[ 0 ];
+    const unsigned int* Ppixel = &m_clists_x.pixel[ 0 ];
+    const short* Pweight = &m_clists_x.weight[ 0 ];
+
+    const unsigned char* Pencode[ CHANNELS ];
+    for( unsigned int c = 0; c < CHANNELS; c++ )
+        Pencode[ c ] = &m_encode[ ( int ) c == m_alpha_channel ][ 0 ];
+
+    for( unsigned int i = 0; i < m_dst_w; i++, Pdst += CHANNELS )
+    {
+        int total[ CHANNELS ];
+        for( unsigned int c = 0; c < CHANNELS; c++ )
+            total[ c ] = WEIGHT_ONE >> 1;
+
+        for( unsigned int j = Pbeg[ i ]; j < Pbeg[ i + 1 ]; j++ )
+        {
+            const short* Ps = Ptmp + Ppixel[ j ];
+            const int w = Pweight[ j ];
+            for( unsigned int c = 0; c < CHANNELS; c++ )
+                total[ c ] += w * Ps[ c ];
+        }
+
+        for( unsigned int c = 0; c < CHANNELS; c++ )
+        {
+            int v = total[ c ] >> WEIGHT_BITS;
+            if( v < 0 ) v = 0; else if( v > LINEAR_MAX ) v = LINEAR_MAX;
+            Pdst[ c ] = Pencode[ c ][ v ];
+        }
+    }
+}
+
+void Resampler_U8::resample_x_line_n( unsigned char* Pdst )
+{
+    const short* Ptmp = &m_tmp[ 0 ];
+
+    for( unsigned int i = 0; i < m_dst_w; i++ )
+    {
+        for( unsigned int c = 0; c < m_num_channels; c++, Pdst++ )
+        {
+            int total = WEIGHT_ONE >> 1;
+            for( unsigned int j = m_clists_x.beg[ i ]; j < m_clists_x.beg[ i + 1 ]; j++ )
+                total += m_clists_x.weight[ j ] * Ptmp[ m_clists_x.pixel[ j ] + c ];
+
+            int v = total >> WEIGHT_BITS;
+            if( v < 0 ) v = 0; else if( v > LINEAR_MAX ) v = LINEAR_MAX;
+            *Pdst = m_encode[ ( int ) c == m_alpha_channel ][ v ];
+        }
+    }
+}
+
+// Sums the source lines of destination line dst_y into m_tmp.
+void Resampler_U8::resample_y_line( const unsigned char* Psrc, unsigned int src_pitch, unsigned int dst_y )
+{
+    const Resampler_Simd_Kernels* Psimd = resampler_simd_kernels();
+    const unsigned int line_size = m_src_x_end - m_src_x_beg;
+
+    const unsigned int beg = m_clists_y.beg[ dst_y ];
+    const unsigned int num = m_clists_y.beg[ dst_y + 1 ] - beg;
+    for( unsigned int k = 0; k < num; k++ )
+        m_Plines[ k ] = decoded_line( Psrc, src_pitch, m_clists_y.pixel[ beg + k ] );
+
+    if( Psimd )
+        Psimd->vert_i16( &m_tmp[ 0 ], &m_Plines[ 0 ], &m_clists_y.weight[ beg ], num, line_size );
+    else
+        vert_i16( &m_tmp[ 0 ], &m_Plines[ 0 ], &m_clists_y.weight[ beg ], num, line_size );
+}
+
+// Resamples channels 0..2 of m_tmp on the X axis into the planar R', G' and B' rows of m_rgb,
+// and adds each pair of samples to the 2x2 block sums in m_rgb_sums (set on the first line of
+// each pair of lines). The last sample of an odd width counts twice.
+void Resampler_U8::resample_x_line_rgb( bool first_line )
+{
+    const short* Ptmp = &m_tmp[ 0 ];
+    const unsigned int* Pbeg = &m_clists_x.beg[ 0 ];
+    const unsigned int* Ppixel = &m_clists_x.pixel[ 0 ];
+    const short* Pweight = &m_clists_x.weight[ 0 ];
+    const unsigned char* Pencode = &m_encode[ 0 ][ 0 ];
+
+    const unsigned int chroma_w = ( m_dst_w + 1 ) >> 1;
+    short* Prgb[ 3 ] = { &m_rgb[ 0 ], &m_rgb[ m_dst_w ], &m_rgb[ 2 * m_dst_w ] };
+    short* Psums[ 3 ] = { &m_rgb_sums[ 0 ], &m_rgb_sums[ chroma_w ], &m_rgb_sums[ 2 * chroma_w ] };
+
+    for( unsigned int i = 0; i < m_dst_w; i++ )
+    {
+        int total[ 3 ];
+        for( unsigned int c = 0; c < 3; c++ )
+            total[ c ] = WEIGHT_ONE >> 1;
+
+        for( unsigned int j = Pbeg[ i ]; j < Pbeg[ i + 1 ]; j++ )
+        {
+            const short* Ps = Ptmp + Ppixel[ j ];
+            const int w = Pweight[ j ];
+            for( unsigned int c = 0; c < 3; c++ )
+                total[ c ] += w * Ps[ c ];
+        }
+
+        for( unsigned int c = 0; c < 3; c++ )
+        {
+            int v = total[ c ] >> WEIGHT_BITS;
+            if( v < 0 ) v = 0; else if( v > LINEAR_MAX ) v = LINEAR_MAX;
+            Prgb[ c ][ i ] = Pencode[ v ];
+        }
+    }
+
+    const unsigned int pairs = m_dst_w >> 1;
+    for( unsigned int c = 0; c < 3; c++ )
+    {
+        const short* Ps = Prgb[ c ];
+        short* Psum = Psums[ c ];
+        if( first_line )
+        {
+            for( unsigned int i = 0; i < pairs; i++ )
+                Psum[ i ] = ( short ) ( Ps[ 2 * i ] + Ps[ 2 * i + 1 ] );
+            if( m_dst_w & 1 )
+                Psum[ pairs ] = ( short ) ( 2 * Ps[ m_dst_w - 1 ] );
+        }
+        else
+        {
+            for( unsigned int i = 0; i < pairs; i++ )
+                Psum[ i ] = ( short ) ( Psum[ i ] + Ps[ 2 * i ] + Ps[ 2 * i + 1 ] );
+            if( m_dst_w & 1 )
+                Psum[ pairs ] = ( short ) ( Psum[ pairs ] + 2 * Ps[ m_dst_w - 1 ] );
+        }
+    }
+}
+
+bool Resampler_U8::resample_image( const unsigned char* Psrc, unsigned int src_pitch, unsigned char* Pdst, unsigned int dst_pitch )
+{
+    if( m_status != Resampler::STATUS_OKAY )
+        return false;
+
+    for( unsigned int i = 0; i < m_num_slots; i++ )
+        m_slot_line[ i ] = -1;
+
+    for( unsigned int y = 0; y < m_dst_h; y++, Pdst += dst_pitch )
+    {
+        // Y axis first, the X axis then only runs on the destination lines.
+        resample_y_line( Psrc, src_pitch, y );
+
+        switch( m_num_channels )
+        {
+            case 1: resample_x_line< 1 >( Pdst ); break;
+            case 2: resample_x_line< 2 >( Pdst ); break;
+            case 3: resample_x_line< 3 >( Pdst ); break;
+            case 4: resample_x_line< 4 >( Pdst ); break;
+            default: resample_x_line_n( Pdst ); break;
+        }
+    }
+
+    return true;
+}
+
+bool Resampler_U8::resample_image_yuv420( const unsigned char* Psrc, unsigned int src_pitch,
+                                          unsigned char* Py, unsigned int y_pitch,
+                                          unsigned char* Pu, unsigned int u_pitch,
+                                          unsigned char* Pv, unsigned int v_pitch,
+                                          Yuv_Matrix matrix )
+{
+    if( ( m_status != Resampler::STATUS_OKAY ) || ( m_num_channels < 3 ) )
+        return false;
+
+    for( unsigned int i = 0; i < m_num_slots; i++ )
+        m_slot_line[ i ] = -1;
+
+    const Resampler_Simd_Kernels* Psimd = resampler_simd_kernels();
+    void ( *Pconvert )( unsigned char*, const short*, const short*, const short*, const short*, unsigned int ) = Psimd ? Psimd->rgb_to_yuv : rgb_to_yuv;
+    const short ( *Pcoefs )[ 4 ] = g_yuv_coefs[ ( matrix == YUV_BT709 ) ? 1 : 0 ];
+
+    const unsigned int chroma_w = ( m_dst_w + 1 ) >> 1;
+    m_rgb.resize( 3 * m_dst_w );
+    m_rgb_sums.resize( 3 * chroma_w );
+    if( !Pv )
+        m_uv.resize( 2 * chroma_w );
+
+    const short* Pr = &m_rgb[ 0 ];
+    const short* Pg = &m_rgb[ m_dst_w ];
+    const short* Pb = &m_rgb[ 2 * m_dst_w ];
+    short* Psum_r = &m_rgb_sums[ 0 ];
+    short* Psum_g = &m_rgb_sums[ chroma_w ];
+    short* Psum_b = &m_rgb_sums[ 2 * chroma_w ];
+
+    for( unsigned int y = 0; y < m_dst_h; y++, Py += y_pitch )
+    {
+        resample_y_line( Psrc, src_pitch, y );
+
+        resample_x_line_rgb( !( y & 1 ) );
+
+        Pconvert( Py, Pr, Pg, Pb, Pcoefs[ 0 ], m_dst_w );
+
+        // The chroma line, once both lines of the pair are in. The last line of an odd height counts twice.
+        if( !( y & 1 ) && ( y + 1 < m_dst_h ) )
+            continue;
+        if( !( y & 1 ) )
+        {
+            for( unsigned int i = 0; i < 3 * chroma_w; i++ )
+                m_rgb_sums[ i ] = ( short ) ( 2 * m_rgb_sums[ i ] );
+        }
+
+        if( Pv )
+        {
+            Pconvert( Pu, Psum_r, Psum_g, Psum_b, Pcoefs[ 1 ], chroma_w );
+            Pconvert( Pv, Psum_r, Psum_g, Psum_b, Pcoefs[ 2 ], chroma_w );
+            Pv += v_pitch;
+        }
+        else
+        {
+            unsigned char* Pcb = &m_uv[ 0 ];
+            unsigned char* Pcr = &m_uv[ chroma_w ];
+            Pconvert( Pcb, Psum_r, Psum_g, Psum_b, Pcoefs[ 1 ], chroma_w );
+            Pconvert( Pcr, Psum_r, Psum_g, Psum_b, Pcoefs[ 2 ], chroma_w );
+            for( unsigned int i = 0; i < chroma_w; i++ )
+            {
+                Pu[ 2 * i ] = Pcb[ i ];
+                Pu[ 2 * i + 1 ] = Pcr[ i ];
+            }
+        }
+        Pu += u_pitch;
+    }
+
+    return true;
+}
+
+// Rounds to the nearest half float, ties to even.
+static unsigned short float_to_half( float f )
+{
+    unsigned int u;
+    memcpy( &u, &f, sizeof( u ) );
+
+    const unsigned int sign = ( u >> 16 ) & 0x8000;
+    u &= 0x7FFFFFFF;
+
+    // Infinities and NaNs, then what rounds to infinity (65520 and up).
+    if( u >= 0x7F800000 )
+        return ( unsigned short ) ( sign | 0x7C00 | ( ( u > 0x7F800000 ) ? 0x200 : 0 ) );
+    if( u >= 0x477FF000 )
+        return ( unsigned short ) ( sign | 0x7C00 );
+
+    unsigned int h, rem, halfway;
+    if( u < 0x38800000 )
+    {
+        // Subnormal halves, below 2^-14. Up to 2^-25 rounds to 0.
+        if( u <= 0x33000000 )
+            return ( unsigned short ) sign;
+        const unsigned int shift = 126 - ( u >> 23 );
+        const unsigned int m = ( u & 0x7FFFFF ) | 0x800000;
+        h = m >> shift;
+        rem = m & ( ( 1U << shift ) - 1 );
+        halfway = 1U << ( shift - 1 );
+    }
+    else
+    {
+        // Rebias the exponent from 127 to 15, a carry out of the mantissa bumps the exponent.
+        h = ( u - 0x38000000 ) >> 13;
+        rem = u & 0x1FFF;
+        halfway = 0x1000;
+    }
+
+    if( ( rem > halfway ) || ( ( rem == halfway ) && ( h & 1 ) ) )
+        h++;
+    return ( unsigned short ) ( sign | h );
+}
+
+// The normalized values of the 256 encoded samples of each channel.
+void Resampler_U8::make_tensor_tables( const Tensor_Format& format, unsigned int num_channels, std::vector< float >& tables )
+{
+    tables.resize( num_channels * 256 );
+    for( unsigned int c = 0; c < num_channels; c++ )
+    {
+        const double mean = format.Pmean ? format.Pmean[ c ] : 0.0;
+        const double std_dev = format.Pstd ? format.Pstd[ c ] : 1.0;
+        for( unsigned int i = 0; i < 256; i++ )
+            tables[ c * 256 + i ] = ( float ) ( ( i / 255.0 - mean ) / std_dev );
+    }
+}
+
+bool Resampler_U8::fits( const Tensor_Format& format, unsigned int x, unsigned int y ) const
+{
+    return ( m_status == Resampler::STATUS_OKAY ) &&
+           ( x <= format.w ) && ( m_dst_w <= format.w - x ) &&
+           ( y <= format.h ) && ( m_dst_h <= format.h - y );
+}
+
+// Resamples each destination line into m_row, then splits it into the planes through the tables.
+// Ptables holds 256 values per channel, the pad values are looked up there too.
+template< typename T >
+void Resampler_U8::write_chw( const unsigned char* Psrc, unsigned int src_pitch, T* Pdst, const Tensor_Format& format,
+                              unsigned int x, unsigned int y, const T* Ptables )
+{
+    const unsigned int n = m_num_channels;
+    const size_t plane_size = ( size_t ) format.w * format.h;
+
+    for( unsigned int i = 0; i < m_num_slots; i++ )
+        m_slot_line[ i ] = -1;
+    m_row.resize( m_dst_w * n );
+
+    for( unsigned int c = 0; c < n; c++ )
+    {
+        const T pad = Ptables[ c * 256 + ( format.Ppad ? format.Ppad[ c ] : 0 ) ];
+        T* Pplane = Pdst + c * plane_size;
+
+        for( size_t i = 0; i < ( size_t ) y * format.w; i++ )
+            Pplane[ i ] = pad;
+        for( size_t i = ( size_t ) ( y + m_dst_h ) * format.w; i < plane_size; i++ )
+            Pplane[ i ] = pad;
+
+        if( ( x > 0 ) || ( m_dst_w < format.w ) )
+        {
+            for( unsigned int j = y; j < y + m_dst_h; j++ )
+            {
+                T* Pline = Pplane + ( size_t ) j * format.w;
+                for( unsigned int i = 0; i < x; i++ )
+                    Pline[ i ] = pad;
+                for( unsigned int i = x + m_dst_w; i < format.w; i++ )
+                    Pline[ i ] = pad;
+            }
+        }
+    }
+
+    unsigned char* Prow = &m_row[ 0 ];
+    for( unsigned int j = 0; j < m_dst_h; j++ )
+    {
+        resample_y_line( Psrc, src_pitch, j );
+
+        switch( n )
+        {
+            case 1: resample_x_line< 1 >( Prow ); break;
+            case 2: resample_x_line< 2 >( Prow ); break;
+            case 3: resample_x_line< 3 >( Prow ); break;
+            case 4: resample_x_line< 4 >( Prow ); break;
+            default: resample_x_line_n( Prow ); break;
+        }
+
+        T* Pline = Pdst + ( size_t ) ( y + j ) * format.w + x;
+        for( unsigned int c = 0; c < n; c++, Pline += plane_size )
+        {
+            const T* Ptable = Ptables + c * 256;
+            const unsigned char* Ps = Prow + c;
+            for( unsigned int i = 0; i < m_dst_w; i++, Ps += n )
+                Pline[ i ] = Ptable[ *Ps ];
+        }
+    }
+}
+
+bool Resampler_U8::resample_image_chw( const unsigned char* Psrc, unsigned int src_pitch, void* Pdst, const Tensor_Format& format, unsigned int x, unsigned int y )
+{
+    if( !fits( format, x, y ) )
+        return false;
+
+    std::vector< float > tables;
+    make_tensor_tables( format, m_num_channels, tables );
+
+    if( format.type == TENSOR_FLOAT16 )
+    {
+        std::vector< unsigned short > half_tables( tables.size() );
+        for( unsigned int i = 0; i < tables.size(); i++ )
+            half_tables[ i ] = float_to_half( tables[ i ] );
+        write_chw( Psrc, src_pitch, static_cast< unsigned short* >( Pdst ), format, x, y, &half_tables[ 0 ] );
+    }
+    else
+        write_chw( Psrc, src_pitch, static_cast< float* >( Pdst ), format, x, y, &tables[ 0 ] );
+
+    return true;
+}
+
+// A range of images of resample_batch_chw(), sharing the tables.
+struct Resampler_U8::Batch_Part
+{
+    const Batch_Image* Pimages;
+    unsigned int n;
+    unsigned char* Pdst;
+    size_t image_bytes;
+    const Tensor_Format* Pformat;
+    const void* Ptables;
+    bool ok;
+};
+
+void Resampler_U8::resample_batch_part( Batch_Part* Ppart )
+{
+    const Tensor_Format& format = *Ppart->Pformat;
+
+    Ppart->ok = true;
+    for( unsigned int k = 0; k < Ppart->n; k++ )
+    {
+        const Batch_Image& image = Ppart->Pimages[ k ];
+        unsigned char* Pdst = Ppart->Pdst + k * Ppart->image_bytes;
+
+        if( !image.Presampler || !image.Presampler->fits( format, image.x, image.y ) )
+        {
+            Ppart->ok = false;
+            continue;
+        }
+
+        if( format.type == TENSOR_FLOAT16 )
+            image.Presampler->write_chw( image.Psrc, image.src_pitch, reinterpret_cast< unsigned short* >( Pdst ), format,
+                                         image.x, image.y, static_cast< const unsigned short* >( Ppart->Ptables ) );
+        else
+            image.Presampler->write_chw( image.Psrc, image.src_pitch, reinterpret_cast< float* >( Pdst ), format,
+                                         image.x, image.y, static_cast< const float* >( Ppart->Ptables ) );
+    }
+}
+
+bool Resampler_U8::resample_batch_chw( const Batch_Image* Pimages, unsigned int n, void* Pdst, const Tensor_Format& format, unsigned int num_threads )
+{
+    if( !n )
+        return true;
+
+    const unsigned int num_channels = Pimages[ 0 ].Presampler ? Pimages[ 0 ].Presampler->m_num_channels : 0;
+    for( unsigned int k = 0; k < n; k++ )
+    {
+        if( !Pimages[ k ].Presampler || ( Pimages[ k ].Presampler->m_num_channels != num_channels ) )
+            return false;
+    }
+
+    std::vector< float > tables;
+    make_tensor_tables( format, num_channels, tables );
+
+    std::vector< unsigned short > half_tables;
+    const void* Ptables = &tables[ 0 ];
+    size_t element_size = sizeof( float );
+    if( format.type == TENSOR_FLOAT16 )
+    {
+        half_tables.resize( tables.size() );
+        for( unsigned int i = 0; i < tables.size(); i++ )
+            half_tables[ i ] = float_to_half( tables[ i ] );
+        Ptables = &half_tables[ 0 ];
+        element_size = sizeof( unsigned short );
+    }
+
+    unsigned int parts = 1;
+#ifdef RESAMPLER_THREADS
+    parts = ( num_threads < n ) ? num_threads : n;
+    if( parts < 1 )
+        parts = 1;
+#else
+    ( void ) num_threads;
+#endif
+
+    const size_t image_bytes = element_size * num_channels * format.w * format.h;
+    std::vector< Batch_Part > batch_parts( parts );
+    unsigned int i = 0;
+    for( unsigned int k = 0; k < parts; k++ )
+    {
+        const unsigned int end = ( unsigned int ) ( ( ( unsigned long long ) n * ( k + 1 ) ) / parts );
+
+        Batch_Part& part = batch_parts[ k ];
+        part.Pimages = Pimages + i;
+        part.n = end - i;
+        part.Pdst = static_cast< unsigned char* >( Pdst ) + i * image_bytes;
+        part.image_bytes = image_bytes;
+        part.Pformat = &format;
+        part.Ptables = Ptables;
+        part.ok = false;
+
+        i = end;
+    }
+
+#ifdef RESAMPLER_THREADS
+    std::vector< std::thread > threads;
+    for( unsigned int k = 1; k < parts; k++ )
+        threads.push_back( std::thread( resample_batch_part, &batch_parts[ k ] ) );
+#endif
+
+    resample_batch_part( &batch_parts[ 0 ] );
+
+#ifdef RESAMPLER_THREADS
+    for( unsigned int k = 0; k < threads.size(); k++ )
+        threads[ k ].join();
+#endif
+
+    bool ok = true;
+    for( unsigned int k = 0; k < parts; k++ )
+        ok = ok && batch_parts[ k ].ok;
+    return ok;
+}
+
+void Resampler_U8::letterbox( unsigned int src_w, unsigned int src_h, unsigned int canvas_w, unsigned int canvas_h,
+                              unsigned int& dst_w, unsigned int& dst_h, unsigned int& x, unsigned int& y )
+{
+    const unsigned long long w = src_w, h = src_h;
+    if( w * canvas_h <= h * canvas_w )
+    {
+        // Height bound.
+        dst_h = canvas_h;
+        dst_w = h ? ( unsigned int ) ( ( w * canvas_h + h / 2 ) / h ) : canvas_w;
+    }
+    else
+    {
+        dst_w = canvas_w;
+        dst_h = w ? ( unsigned int ) ( ( h * canvas_w + w / 2 ) / w ) : canvas_h;
+    }
+
+    if( dst_w < 1 ) dst_w = 1; else if( dst_w > canvas_w ) dst_w = canvas_w;
+    if( dst_h < 1 ) dst_h = 1; else if( dst_h > canvas_h ) dst_h = canvas_h;
+
+    x = ( canvas_w - dst_w ) / 2;
+    y = ( canvas_h - dst_h ) / 2;
+}
@@ -0,0 +1,258 @@
+// resampler_yuv.cpp - Y'CbCr 4:2:0 frame resizing, see Resampler_Yuv420 in resampler.h.
+#include <cassert>
+#include "resampler.h"
+
+// The chroma planes are resampled on worker threads with C++11 threads, like resampler.cpp.
+#if !defined( RESAMPLER_NO_THREADS ) && ( ( __cplusplus >= 201103L ) || ( defined( _MSC_VER ) && ( _MSC_VER >= 1700 ) ) )
+#define RESAMPLER_THREADS 1
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
+
+// One plane of a frame.
+struct Resampler_Yuv420::Plane_Job
+{
+    Resampler_U8* Presampler;
+    const unsigned char* Psrc;
+    unsigned int src_pitch;
+    unsigned char* Pdst;
+    unsigned int dst_pitch;
+    bool ok;
+};
+
+// Worker k - 1 runs job k (Cb, or the Cb/Cr pairs, then Cr) of each frame. Frames are numbered, a
+// worker runs once per new frame number, and the last one done wakes the frame's thread.
+struct Resampler_Yuv420::Workers
+{
+#ifdef RESAMPLER_THREADS
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable finish;
+    Plane_Job* Pjobs;
+    unsigned int num_jobs;
+    unsigned int frame;
+    unsigned int pending;
+    bool quit;
+    std::thread threads[ 2 ];
+#endif
+};
+
+Resampler_Yuv420::Resampler_Yuv420
+    (
+    unsigned int src_w, unsigned int src_h,
+    unsigned int dst_w, unsigned int dst_h,
+    bool nv12,
+    Chroma_Siting siting,
+    Resampler::Boundary_Op boundary_op,
+    const char* Pfilter_name,
+    Resample_Real filter_x_scale,
+    Resample_Real filter_y_scale,
+    bool parallel
+    )
+{
+    m_Pworkers = NULL;
+    m_src_w = m_src_h = m_dst_w = m_dst_h = 0;
+    m_nv12 = nv12;
+    m_siting = siting;
+    m_boundary_op = boundary_op;
+    m_filter_x_scale = filter_x_scale;
+    m_filter_y_scale = filter_y_scale;
+
+    m_Pfilter_name = Resampler::resolve_filter( Resampler::Filter_Desc::named( Pfilter_name ? Pfilter_name : RESAMPLER_DEFAULT_FILTER ) );
+    if( !m_Pfilter_name )
+    {
+        m_status = Resampler::STATUS_BAD_FILTER_NAME;
+        return;
+    }
+
+    init( src_w, src_h, dst_w, dst_h, nv12, siting );
+
+#ifdef RESAMPLER_THREADS
+    if( parallel )
+    {
+        m_Pworkers = new Workers;
+        m_Pworkers->Pjobs = NULL;
+        m_Pworkers->num_jobs = 0;
+        m_Pworkers->frame = 0;
+        m_Pworkers->pending = 0;
+        m_Pworkers->quit = false;
+        for( unsigned int k = 0; k < 2; k++ )
+            m_Pworkers->threads[ k ] = std::thread( worker_thread, m_Pworkers, k + 1 );
+    }
+#else
+    ( void ) parallel;
+#endif
+}
+
+Resampler_Yuv420::~Resampler_Yuv420()
+{
+#ifdef RESAMPLER_THREADS
+    if( m_Pworkers )
+    {
+        {
+            std::lock_guard< std::mutex > lock( m_Pworkers->mutex );
+            m_Pworkers->quit = true;
+        }
+        m_Pworkers->start.notify_all();
+        for( unsigned int k = 0; k < 2; k++ )
+            m_Pworkers->threads[ k ].join();
+    }
+#endif
+    delete m_Pworkers;
+}
+
+// Builds the tables of the planes.
+void Resampler_Yuv420::init( unsigned int src_w, unsigned int src_h, unsigned int dst_w, unsigned int dst_h, bool nv12, Chroma_Siting siting )
+{
+    m_src_w = src_w;
+    m_src_h = src_h;
+    m_dst_w = dst_w;
+    m_dst_h = dst_h;
+    m_nv12 = nv12;
+    m_siting = siting;
+
+    m_Pu.reset();
+    m_Pv.reset();
+
+    m_Py.reset( new Resampler_U8( src_w, src_h, dst_w, dst_h, 1, 1.0f, -1, m_boundary_op, m_Pfilter_name, m_filter_x_scale, m_filter_y_scale ) );
+    m_status = m_Py->status();
+    if( m_status != Resampler::STATUS_OKAY )
+        return;
+
+    const Resample_Real x_ofs = chroma_offset( src_w, dst_w, siting != CHROMA_CENTER );
+    const Resample_Real y_ofs = chroma_offset( src_h, dst_h, siting == CHROMA_TOP_LEFT );
+
+    m_Pu.reset( new Resampler_U8( ( src_w + 1 ) >> 1, ( src_h + 1 ) >> 1, ( dst_w + 1 ) >> 1, ( dst_h + 1 ) >> 1, nv12 ? 2 : 1, 1.0f, -1,
+                                  m_boundary_op, m_Pfilter_name, m_filter_x_scale, m_filter_y_scale, 0, 0, 0, 0, x_ofs, y_ofs ) );
+    m_status = m_Pu->status();
+    if( m_status != Resampler::STATUS_OKAY )
+        return;
+
+    if( !nv12 )
+        m_Pv.reset( new Resampler_U8( *m_Pu ) );
+}
+
+Resampler::Status Resampler_Yuv420::reset( unsigned int src_w, unsigned int src_h, unsigned int dst_w, unsigned int dst_h,
+                                           bool nv12, Chroma_Siting siting )
+{
+    if( !m_Pfilter_name )
+        return m_status;
+
+    if( ( m_status == Resampler::STATUS_OKAY ) &&
+        ( src_w == m_src_w ) && ( src_h == m_src_h ) && ( dst_w == m_dst_w ) && ( dst_h == m_dst_h ) &&
+        ( nv12 == m_nv12 ) && ( siting == m_siting ) )
+        return m_status;
+
+    init( src_w, src_h, dst_w, dst_h, nv12, siting );
+    return m_status;
+}
+
+// Chroma sample j of a plane is at luma sample 2 * j + 0.5 if cosited, 2 * j + 1 if not, in
+// continuous coordinates (luma sample i covers [i, i + 1)). Resampler puts the center of
+// destination sample d at ( d + 0.5 ) * src / dst - 0.5 + src_ofs in the source plane.
+Resample_Real Resampler_Yuv420::chroma_offset( unsigned int src_luma, unsigned int dst_luma, bool cosited )
+{
+    const double src_chroma = ( src_luma + 1 ) >> 1;
+    const double dst_chroma = ( dst_luma + 1 ) >> 1;
+    const double s = cosited ? 0.25 : 0.0;
+
+    // d + 0.5 at the middle of the destination plane.
+    const double d = dst_chroma * 0.5;
+
+    // The destination chroma sample is at luma 2 * ( d - s ) in the destination, which maps to
+    // luma 2 * ( d - s ) * src_luma / dst_luma in the source, chroma sample ( d - s ) * src_luma / dst_luma - 0.5 + s.
+    const double want = ( d - s ) * src_luma / dst_luma - 0.5 + s;
+    const double got = d * src_chroma / dst_chroma - 0.5;
+
+    return ( Resample_Real ) ( want - got );
+}
+
+void Resampler_Yuv420::resample_plane( Plane_Job* Pjob )
+{
+    Pjob->ok = Pjob->Presampler->resample_image( Pjob->Psrc, Pjob->src_pitch, Pjob->Pdst, Pjob->dst_pitch );
+}
+
+void Resampler_Yuv420::worker_thread( Workers* Pworkers, unsigned int job )
+{
+#ifdef RESAMPLER_THREADS
+    unsigned int frame = 0;
+    for( ;; )
+    {
+        Plane_Job* Pjob = NULL;
+        {
+            std::unique_lock< std::mutex > lock( Pworkers->mutex );
+            while( !Pworkers->quit && ( Pworkers->frame == frame ) )
+                Pworkers->start.wait( lock );
+            if( Pworkers->quit )
+                return;
+            frame = Pworkers->frame;
+            if( job < Pworkers->num_jobs )
+                Pjob = &Pworkers->Pjobs[ job ];
+        }
+
+        // NV12 has no Cr job.
+        if( !Pjob )
+            continue;
+
+        resample_plane( Pjob );
+
+        std::lock_guard< std::mutex > lock( Pworkers->mutex );
+        if( !--Pworkers->pending )
+            Pworkers->finish.notify_one();
+    }
+#else
+    ( void ) Pworkers;
+    ( void ) job;
+#endif
+}
+
+bool Resampler_Yuv420::resample_frame( const unsigned char* Psrc_y, unsigned int src_y_pitch,
+                                       const unsigned char* Psrc_u, unsigned int src_u_pitch,
+                                       const unsigned char* Psrc_v, unsigned int src_v_pitch,
+                                       unsigned char* Pdst_y, unsigned int dst_y_pitch,
+                                       unsigned char* Pdst_u, unsigned int dst_u_pitch,
+                                       unsigned char* Pdst_v, unsigned int dst_v_pitch )
+{
+    if( m_status != Resampler::STATUS_OKAY )
+        return false;
+
+    Plane_Job jobs[ 3 ] =
+    {
+        { m_Py.get(), Psrc_y, src_y_pitch, Pdst_y, dst_y_pitch, false },
+        { m_Pu.get(), Psrc_u, src_u_pitch, Pdst_u, dst_u_pitch, false },
+        { m_Pv.get(), Psrc_v, src_v_pitch, Pdst_v, dst_v_pitch, false }
+    };
+    const unsigned int num_jobs = m_Pv.get() ? 3 : 2;
+
+#ifdef RESAMPLER_THREADS
+    if( m_Pworkers )
+    {
+        {
+            std::lock_guard< std::mutex > lock( m_Pworkers->mutex );
+            m_Pworkers->Pjobs = jobs;
+            m_Pworkers->num_jobs = num_jobs;
+            m_Pworkers->pending = num_jobs - 1;
+            m_Pworkers->frame++;
+        }
+        m_Pworkers->start.notify_all();
+
+        // The luma plane is the biggest, it's done on this thread.
+        resample_plane( &jobs[ 0 ] );
+
+        std::unique_lock< std::mutex > lock( m_Pworkers->mutex );
+        while( m_Pworkers->pending )
+            m_Pworkers->finish.wait( lock );
+    }
+    else
+#endif
+    {
+        for( unsigned int k = 0; k < num_jobs; k++ )
+            resample_plane( &jobs[ k ] );
+    }
+
+    bool ok = true;
+    for( unsigned int k = 0; k < num_jobs; k++ )
+        ok = ok && jobs[ k ].ok;
+    return ok;
+}
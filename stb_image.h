@@ -299,6 +299,13 @@ STBIDEF int      stbi_info_from_file  (FILE *f,                  int *x, int *y,
 // unpremultiplication. results are undefined if the unpremultiply overflow.
 STBIDEF void stbi_set_unpremultiply_on_load(int flag_true_if_should_unpremultiply);
 
+// decode JPEGs at 1/denom of their size (1, 2, 4 or 8; anything else is 1) by
+// only inverse transforming the low frequencies of each block. the returned
+// width and height are rounded up, i.e. ceil(width/denom). much faster than
+// decoding at full size when the image is going to be reduced anyway. other
+// formats are always decoded at full size.
+STBIDEF void stbi_set_jpeg_scale_denom(int denom);
+
 // indicate whether we should process iphone images back to canonical format,
 // or just pass them through "as-is"
 STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert);
@@ -1032,6 +1039,7 @@ typedef struct
       int dc_pred;
 
       int x,y,w2,h2;
+      int idct_shift;   // log2 of this component's IDCT reduction, see stbi__process_frame_header
       stbi_uc *data;
       void *raw_data;
       stbi_uc *linebuf;
@@ -1044,6 +1052,8 @@ typedef struct
 
    int scan_n, order[4];
    int restart_interval, todo;
+
+   int scale_shift;             // log2 of the decode reduction, blocks are 8>>scale_shift pixels
 } stbi__jpeg;
 
 static int stbi__build_huffman(stbi__huffman *h, int *count)
@@ -1356,6 +1366,64 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64], stbi_
    }
 }
 
+// reduced size IDCT: transforms the low nxn coefficients to nxn pixels (n = 8>>shift),
+// which is the block's content at 1/(1<<shift) scale (this is what libjpeg does too).
+// each 1d pass is out[x] = sum c(u)/2 * cos((2x+1)u*pi/2n) * in[u]
+static const int stbi__idct_cos2[2][2] =
+{
+   { stbi__f2f(0.353553391f), stbi__f2f( 0.353553391f) },
+   { stbi__f2f(0.353553391f), stbi__f2f(-0.353553391f) },
+};
+
+static const int stbi__idct_cos4[4][4] =
+{
+   { stbi__f2f(0.353553391f), stbi__f2f( 0.461939766f), stbi__f2f( 0.353553391f), stbi__f2f( 0.191341716f) },
+   { stbi__f2f(0.353553391f), stbi__f2f( 0.191341716f), stbi__f2f(-0.353553391f), stbi__f2f(-0.461939766f) },
+   { stbi__f2f(0.353553391f), stbi__f2f(-0.191341716f), stbi__f2f(-0.353553391f), stbi__f2f( 0.461939766f) },
+   { stbi__f2f(0.353553391f), stbi__f2f(-0.461939766f), stbi__f2f( 0.353553391f), stbi__f2f(-0.191341716f) },
+};
+
+static void stbi__idct_reduced(stbi_uc *out, int out_stride, short data[64], stbi_dequantize_t *dequantize, int shift)
+{
+   int i,j,u,n = 8 >> shift,val[16];
+   const int *c;
+
+   if (n == 1) {
+      // just the DC term, the block's average
+      out[0] = stbi__clamp(((data[0] * dequantize[0] + 4) >> 3) + 128);
+      return;
+   }
+   c = (n == 4) ? stbi__idct_cos4[0] : stbi__idct_cos2[0];
+
+   // columns, keeping 2 extra bits of precision like stbi__idct_block
+   for (i=0; i < n; ++i) {
+      for (j=0; j < n; ++j) {
+         int sum = 0;
+         for (u=0; u < n; ++u)
+            sum += c[j*n+u] * (data[u*8+i] * dequantize[u*8+i]);
+         val[j*n+i] = (sum + 512) >> 10;
+      }
+   }
+
+   // rows: 1<<12 from the constants and 1<<2 from the first pass to remove,
+   // rounded, and biased from -128..127 to 0..255
+   for (j=0; j < n; ++j, out += out_stride) {
+      for (i=0; i < n; ++i) {
+         int sum = (1 << 13) + (128 << 14);
+         for (u=0; u < n; ++u)
+            sum += c[i*n+u] * val[j*n+u];
+         out[i] = stbi__clamp(sum >> 14);
+      }
+   }
+}
+
+static int stbi__jpeg_scale_shift = 0;
+
+STBIDEF void stbi_set_jpeg_scale_denom(int denom)
+{
+   stbi__jpeg_scale_shift = (denom == 8) ? 3 : (denom == 4) ? 2 : (denom == 2) ? 1 : 0;
+}
+
 #ifdef STBI_SIMD
 static stbi_idct_8x8 stbi__idct_installed = stbi__idct_block;
 
@@ -1398,6 +1466,12 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+#ifdef STBI_SIMD
+#define STBI__DEQUANT(z,n)  ((z)->dequant2[(z)->img_comp[n].tq])
+#else
+#define STBI__DEQUANT(z,n)  ((z)->dequant[(z)->img_comp[n].tq])
+#endif
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
@@ -1414,9 +1488,13 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
       // component has, independent of interleaved MCU blocking and such
       int w = (z->img_comp[n].x+7) >> 3;
       int h = (z->img_comp[n].y+7) >> 3;
+      int bs = 8 >> z->img_comp[n].idct_shift;
       for (j=0; j < h; ++j) {
          for (i=0; i < w; ++i) {
             if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+z->img_comp[n].ha, n)) return 0;
+            if (z->img_comp[n].idct_shift)
+               stbi__idct_reduced(z->img_comp[n].data+z->img_comp[n].w2*j*bs+i*bs, z->img_comp[n].w2, data, STBI__DEQUANT(z,n), z->img_comp[n].idct_shift);
+            else
             #ifdef STBI_SIMD
             stbi__idct_installed(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
             #else
@@ -1440,13 +1518,17 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
             // scan an interleaved mcu... process scan_n components in order
             for (k=0; k < z->scan_n; ++k) {
                int n = z->order[k];
+               int bs = 8 >> z->img_comp[n].idct_shift;
                // scan out an mcu's worth of this component; that's just determined
                // by the basic H and V specified for the component
                for (y=0; y < z->img_comp[n].v; ++y) {
                   for (x=0; x < z->img_comp[n].h; ++x) {
-                     int x2 = (i*z->img_comp[n].h + x)*8;
-                     int y2 = (j*z->img_comp[n].v + y)*8;
+                     int x2 = (i*z->img_comp[n].h + x)*bs;
+                     int y2 = (j*z->img_comp[n].v + y)*bs;
                      if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+z->img_comp[n].ha, n)) return 0;
+                     if (z->img_comp[n].idct_shift)
+                        stbi__idct_reduced(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, STBI__DEQUANT(z,n), z->img_comp[n].idct_shift);
+                     else
                      #ifdef STBI_SIMD
                      stbi__idct_installed(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
                      #else
@@ -1618,8 +1700,17 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // the bogus oversized data from using interleaved MCUs and their
       // big blocks (stbi__err.g. a 16x16 iMCU on an image of width 33); we won't
       // discard the extra data until colorspace conversion
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      // when decoding at reduced size, blocks are 8>>idct_shift pixels. a component
+      // subsampled by 2 or 4 on both axes is reduced that much less, which puts it
+      // at the luma resolution instead of upsampling it from 1/16 or 1/32 scale
+      z->img_comp[i].idct_shift = z->scale_shift;
+      if (h_max / z->img_comp[i].h == v_max / z->img_comp[i].v && h_max % z->img_comp[i].h == 0 && v_max % z->img_comp[i].v == 0) {
+         int sub = (h_max / z->img_comp[i].h == 4) ? 2 : (h_max / z->img_comp[i].h == 2) ? 1 : 0;
+         if (sub <= z->scale_shift)
+            z->img_comp[i].idct_shift -= sub;
+      }
+      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * (8 >> z->img_comp[i].idct_shift);
+      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * (8 >> z->img_comp[i].idct_shift);
       z->img_comp[i].raw_data = stbi__malloc(z->img_comp[i].w2 * z->img_comp[i].h2+15);
       if (z->img_comp[i].raw_data == NULL) {
          for(--i; i >= 0; --i) {
@@ -1861,8 +1952,13 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
 
    // load a jpeg image from whichever source
+   z->scale_shift = stbi__jpeg_scale_shift;
    if (!decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
 
+   // from here on, the image is its reduced size
+   z->s->img_x = (z->s->img_x + (1 << z->scale_shift) - 1) >> z->scale_shift;
+   z->s->img_y = (z->s->img_y + (1 << z->scale_shift) - 1) >> z->scale_shift;
+
    // determine actual number of components to generate
    n = req_comp ? req_comp : z->s->img_n;
 
@@ -1888,8 +1984,9 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
          z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
          if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
 
-         r->hs      = z->img_h_max / z->img_comp[k].h;
-         r->vs      = z->img_v_max / z->img_comp[k].v;
+         // a component decoded at less reduction than the image needs less upsampling
+         r->hs      = (z->img_h_max / z->img_comp[k].h) >> (z->scale_shift - z->img_comp[k].idct_shift);
+         r->vs      = (z->img_v_max / z->img_comp[k].v) >> (z->scale_shift - z->img_comp[k].idct_shift);
          r->ystep   = r->vs >> 1;
          r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
          r->ypos    = 0;
@@ -1919,7 +2016,7 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
             if (++r->ystep >= r->vs) {
                r->ystep = 0;
                r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
+               if (++r->ypos < (z->img_comp[k].y + (1 << z->img_comp[k].idct_shift) - 1) >> z->img_comp[k].idct_shift)
                   r->line1 += z->img_comp[k].w2;
             }
          }
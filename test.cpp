@@ -18,9 +18,14 @@
 
 int main(int arg_c, char** arg_v)
 {
+   // -int as the last argument resamples with Resampler_U8 instead of the float path.
+   const bool use_integer_pipeline = (arg_c == 6 || arg_c == 10) && (strcmp(arg_v[arg_c - 1], "-int") == 0);
+   if (use_integer_pipeline)
+      arg_c--;
+
    if (arg_c != 9 && arg_c != 5)
    {
-      printf("Usage: input_image output_image.tga width height [subrect-x] [subrect-y] [subrect-width] [subrect-height]\n");
+      printf("Usage: input_image output_image.tga width height [subrect-x] [subrect-y] [subrect-width] [subrect-height] [-int]\n");
       return EXIT_FAILURE;
    }
    
@@ -54,6 +59,16 @@ int main(int arg_c, char** arg_v)
    
    printf("Loading image: %s\n", pSrc_filename);
    
+   // JPEGs can be decoded at 1/2, 1/4 or 1/8 size for much less than a full decode. Use the
+   // largest reduction that still leaves at least as many pixels as the destination.
+   int full_width = 0, full_height = 0, jpeg_denom = 1;
+   if (stbi_info(pSrc_filename, &full_width, &full_height, NULL))
+   {
+      while ((jpeg_denom < 8) && (full_width >= jpeg_denom * 2 * dst_width) && (full_height >= jpeg_denom * 2 * dst_height))
+         jpeg_denom *= 2;
+   }
+   stbi_set_jpeg_scale_denom(jpeg_denom);
+
    int src_width, src_height, n;
    unsigned char* pSrc_image = stbi_load(pSrc_filename, &src_width, &src_height, &n, 0);
    if (!pSrc_image)
@@ -62,6 +77,20 @@ int main(int arg_c, char** arg_v)
       return EXIT_FAILURE;
    }
    printf("Resolution: %ux%u, Channels: %u\n", src_width, src_height, n);
+
+   // A reduced JPEG is rounded up to whole pixels, so it covers a little more than the image. Resample
+   // to the destination size it would have at that scale, and crop the destination back out of it.
+   // That size is rounded too: offset the source so the remaining drift is centered on the destination.
+   int resample_width = dst_width, resample_height = dst_height;
+   float src_x_ofs = 0.0f, src_y_ofs = 0.0f;
+   if ((src_width != full_width) || (src_height != full_height))
+   {
+      printf("Decoded at 1/%i size\n", jpeg_denom);
+      resample_width = (int)((double)dst_width * src_width * jpeg_denom / full_width + .5);
+      resample_height = (int)((double)dst_height * src_height * jpeg_denom / full_height + .5);
+      src_x_ofs = (float)(.5 * ((double)full_width / jpeg_denom - (double)dst_width * src_width / resample_width));
+      src_y_ofs = (float)(.5 * ((double)full_height / jpeg_denom - (double)dst_height * src_height / resample_height));
+   }
    
    const int max_components = 4;   
    
@@ -96,16 +125,84 @@ int main(int arg_c, char** arg_v)
       linear_to_srgb[i] = (unsigned char)k;
    }
    
+   unsigned int x_factor, y_factor;
+   if (Resampler::is_replication(src_width, src_height, resample_width, resample_height, pFilter, x_factor, y_factor, filter_scale, filter_scale, src_x_ofs, src_y_ofs))
+   {
+      // Pixel replication: skip the float pipeline, but still round trip each value through the
+      // linear conversions so the output is identical to what the resamplers would produce.
+      printf("Replicating pixels %ux%u\n", x_factor, y_factor);
+
+      unsigned char round_trip[2][256];
+      for (int i = 0; i < 256; ++i)
+      {
+         int j = (int)(linear_to_srgb_table_size * srgb_to_linear[i] + .5f);
+         if (j < 0) j = 0; else if (j >= linear_to_srgb_table_size) j = linear_to_srgb_table_size - 1;
+         round_trip[0][i] = linear_to_srgb[j];
+
+         int c = (int)(255.0f * (i * (1.0f/255.0f)) + .5f);
+         if (c < 0) c = 0; else if (c > 255) c = 255;
+         round_trip[1][i] = (unsigned char)c;
+      }
+
+      for (int i = 0; i < src_width * src_height * n; i++)
+      {
+         const int c = i % n;
+         const bool alpha_channel = (c == 3) || ((n == 2) && (c == 1));
+         pSrc_image[i] = round_trip[alpha_channel][pSrc_image[i]];
+      }
+
+      std::vector<unsigned char> dst_image(subrect_w * n * subrect_h);
+      Resampler::replicate(pSrc_image, src_width * n, &dst_image[0], subrect_w * n, n, x_factor, y_factor, subrect_x, subrect_y, subrect_w, subrect_h);
+
+      printf("Writing TGA file: %s\n", pDst_filename);
+
+      if (!stbi_write_tga(pDst_filename, subrect_w, subrect_h, n, &dst_image[0]))
+      {
+         printf("Failed writing output image!\n");
+         return EXIT_FAILURE;
+      }
+
+      stbi_image_free(pSrc_image);
+      return EXIT_SUCCESS;
+   }
+
+   // The integer pipeline matches the float path below within 1, and is several times faster.
+   if (use_integer_pipeline)
+   {
+      const int alpha_channel = (n == 4) ? 3 : ((n == 2) ? 1 : -1);
+      Resampler_U8 resampler(src_width, src_height, resample_width, resample_height, n, source_gamma, alpha_channel, Resampler::BOUNDARY_CLAMP, pFilter, filter_scale, filter_scale, subrect_x, subrect_y, subrect_w, subrect_h, src_x_ofs, src_y_ofs);
+
+      printf("Resampling to %ux%u (integer, %s)\n", dst_width, dst_height, Resampler::get_simd_target());
+
+      std::vector<unsigned char> dst_image(subrect_w * n * subrect_h);
+      if (!resampler.resample_image(pSrc_image, src_width * n, &dst_image[0], subrect_w * n))
+      {
+         printf("Out of memory!\n");
+         return EXIT_FAILURE;
+      }
+
+      printf("Writing TGA file: %s\n", pDst_filename);
+
+      if (!stbi_write_tga(pDst_filename, subrect_w, subrect_h, n, &dst_image[0]))
+      {
+         printf("Failed writing output image!\n");
+         return EXIT_FAILURE;
+      }
+
+      stbi_image_free(pSrc_image);
+      return EXIT_SUCCESS;
+   }
+
    Resampler* resamplers[max_components];
    std::vector<float> samples[max_components];
    
    // Now create a Resampler instance for each component to process. The first instance will create new contributor tables, which are shared by the resamplers 
    // used for the other components (a memory and slight cache efficiency optimization).
-   resamplers[0] = new Resampler(src_width, src_height, dst_width, dst_height, Resampler::BOUNDARY_CLAMP, 0.0f, 1.0f, pFilter, NULL, NULL, filter_scale, filter_scale, 0.0f, 0.0f, subrect_x, subrect_y, subrect_w, subrect_h );
+   resamplers[0] = new Resampler(src_width, src_height, resample_width, resample_height, Resampler::BOUNDARY_CLAMP, 0.0f, 1.0f, pFilter, NULL, NULL, filter_scale, filter_scale, src_x_ofs, src_y_ofs, subrect_x, subrect_y, subrect_w, subrect_h );
    samples[0].resize(src_width);
    for (int i = 1; i < n; i++)
    {
-      resamplers[i] = new Resampler(src_width, src_height, dst_width, dst_height, Resampler::BOUNDARY_CLAMP, 0.0f, 1.0f, pFilter, resamplers[0]->get_clist_x(), resamplers[0]->get_clist_y(), filter_scale, filter_scale, 0.0f, 0.0f, subrect_x, subrect_y, subrect_w, subrect_h );
+      resamplers[i] = new Resampler(src_width, src_height, resample_width, resample_height, Resampler::BOUNDARY_CLAMP, 0.0f, 1.0f, pFilter, resamplers[0]->get_clist_x(), resamplers[0]->get_clist_y(), filter_scale, filter_scale, src_x_ofs, src_y_ofs, subrect_x, subrect_y, subrect_w, subrect_h );
       samples[i].resize(src_width);
    }      
       
@@ -115,7 +212,7 @@ int main(int arg_c, char** arg_v)
    const int dst_pitch = subrect_w * n;
    int dst_y = 0;
    
-   printf("Resampling to %ux%u\n", dst_width, dst_height);
+   printf("Resampling to %ux%u (%s)\n", dst_width, dst_height, Resampler::get_simd_target());
       
    for (int src_y = 0; src_y < src_height; src_y++)
    {